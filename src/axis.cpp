@@ -1,12 +1,27 @@
 #include "axis.h"
 #include "event.h"
 #include "time.h"
+#include "stats.h"
+#include "scheduler.h"
+
+#include <algorithm>
+
+static Stat deadZoneEvents("Axis events inside dead zone");
+static Stat hysteresisEvents("Axis events held by hysteresis");
+static Stat rateLimitEvents("Axis events coalesced by rate limit");
+static Stat euroCorrection("Axis 1€ filter correction");
 
 #define sqr(a) ((a)*(a))
 #define cub(a)	((a)*(a)*(a))
 #define clamp(a, a_low, a_high)	\
 	((a) < (a_low) ? (a_low) : (a) > (a_high) ? (a_high) : (a))
 
+//smoothing factor of a first order low pass with the given cutoff (Hz),
+//sampled every dt seconds
+static inline float lowPassAlpha( float cutoff, float dt ) {
+    return 1.0F / (1.0F + 1.0F / (2.0F * (float) M_PI * cutoff * dt));
+}
+
 
 Axis::Axis( int i, QObject *parent ) : QObject(parent) {
     index = i;
@@ -14,8 +29,13 @@ Axis::Axis( int i, QObject *parent ) : QObject(parent) {
     isDown = false;
     state = 0;
     gradient = false;
+    kernelDZoneNeg = 0;
+    kernelDZonePos = 0;
+    euroValid = false;
+    hasPending = false;
+    intervalTimer.setSingleShot(true);
+    connect(&intervalTimer, SIGNAL(timeout()), this, SLOT(intervalElapsed()));
     toDefault();
-    tick = 0;
 }
 
 
@@ -64,6 +84,48 @@ bool Axis::read( QTextStream &stream ) {
             val = (*it).toInt(&ok);
             if (ok && val >= 0 && val <= JOYMAX) xZone = val;
             else return false;
+        }
+        //the period (msec) and resolution of keyboard gradient pulses
+        else if (*it == "pwmperiod") {
+            ++it;
+            if (it == words.end()) return false;
+            val = (*it).toInt(&ok);
+            if (ok && val >= MINPWMPERIOD && val <= MAXPWMPERIOD) pwmPeriod = val;
+            else return false;
+        }
+        else if (*it == "pwmsteps") {
+            ++it;
+            if (it == words.end()) return false;
+            val = (*it).toInt(&ok);
+            if (ok && val >= 1 && val <= MAXPWMSTEPS) pwmSteps = val;
+            else return false;
+        }
+        else if (*it == "hysteresis") {
+            ++it;
+            if (it == words.end()) return false;
+            val = (*it).toInt(&ok);
+            if (ok && val >= 0 && val <= JOYMAX) hysteresis = val;
+            else return false;
+        }
+        else if (*it == "mininterval") {
+            ++it;
+            if (it == words.end()) return false;
+            val = (*it).toInt(&ok);
+            if (ok && val >= 0 && val <= MAXINTERVAL) minInterval = val;
+            else return false;
+        }
+        //the 1€ filter takes two values, the minimum cutoff and beta
+        else if (*it == "oneeuro") {
+            ++it;
+            if (it == words.end()) return false;
+            fval = (*it).toFloat(&ok);
+            if (ok && fval >= 0 && fval <= MAXCUTOFF) euroMinCutoff = fval;
+            else return false;
+            ++it;
+            if (it == words.end()) return false;
+            fval = (*it).toFloat(&ok);
+            if (ok && fval >= 0) euroBeta = fval;
+            else return false;
         }
 		else if (*it == "tcurve") {
 			++it;
@@ -80,46 +142,27 @@ bool Axis::read( QTextStream &stream ) {
 				sensitivity = fval;
 			else return false;
 		}
-        //and for the positive keycode,
-        else if (*it == "+key") {
+        //and for the positive keycode, maybe with modifiers ("0xffe3+0x74"),
+        else if (*it == "+key" || *it == "+mouse") {
+            puseMouse = (*it == "+mouse");
             ++it;
             if (it == words.end()) return false;
-            val = (*it).toInt(&ok);
-            if (ok && val >= 0 && val <= MAXKEY) pkeycode = val;
-            else return false;
+            if (!readchord(*it, puseMouse, pmodifiers, pkeycode)) return false;
         }
         //and finally for the negative keycode.
-        else if (*it == "-key") {
-            ++it;
-            if (it == words.end()) return false;
-            val = (*it).toInt(&ok);
-            if (ok && val >= 0 && val <= MAXKEY) nkeycode = val;
-            else return false;
-        }
-        else if (*it == "+mouse") {
-            ++it;
-            if (it == words.end()) return false;
-            val = (*it).toInt(&ok);
-            if (ok && val >= 0 && val <= MAXKEY) {
-                puseMouse = true;
-                pkeycode = val;
-            }
-            else return false;
-        }
-        else if (*it == "-mouse") {
+        else if (*it == "-key" || *it == "-mouse") {
+            nuseMouse = (*it == "-mouse");
             ++it;
             if (it == words.end()) return false;
-            val = (*it).toInt(&ok);
-            if (ok && val >= 0 && val <= MAXKEY) {
-                nuseMouse = true;
-                nkeycode = val;
-            }
-            else return false;
+            if (!readchord(*it, nuseMouse, nmodifiers, nkeycode)) return false;
         }
         //the rest of the options are keywords without integers
         else if (*it == "gradient") {
             gradient = true;
         }
+        else if (*it == "kerneldzone") {
+            kernelDZone = true;
+        }
         else if (*it == "throttle+") {
             throttle = 1;
         }
@@ -152,7 +195,7 @@ bool Axis::read( QTextStream &stream ) {
 }
 
 void Axis::timerCalled() {
-    timerTick(++tick);
+    timerTick();
 }
 
 void Axis::write( QTextStream &stream ) {
@@ -161,11 +204,17 @@ void Axis::write( QTextStream &stream ) {
     if (throttle > 0) stream << "throttle+, ";
     else if (throttle < 0) stream << "throttle-, ";
     if (dZone != DZONE) stream << "dZone " << dZone << ", ";
+    if (kernelDZone) stream << "kernelDZone, ";
     if (xZone != XZONE) stream << "xZone " << xZone << ", ";
+    if (pwmPeriod != PWMPERIOD) stream << "pwmPeriod " << pwmPeriod << ", ";
+    if (pwmSteps != PWMSTEPS) stream << "pwmSteps " << pwmSteps << ", ";
+    if (hysteresis != 0) stream << "hysteresis " << hysteresis << ", ";
+    if (minInterval != 0) stream << "minInterval " << minInterval << ", ";
+    if (euroMinCutoff != 0) stream << "oneEuro " << euroMinCutoff << " " << euroBeta << ", ";
     if (mode == Keyboard) {
         stream
-            << (puseMouse ? "+mouse " : "+key ") << pkeycode << ", "
-            << (nuseMouse ? "-mouse " : "-key ") << nkeycode << "\n";
+            << (puseMouse ? "+mouse " : "+key ") << writechord(pmodifiers, puseMouse, pkeycode) << ", "
+            << (nuseMouse ? "-mouse " : "-key ") << writechord(nmodifiers, nuseMouse, nkeycode) << "\n";
     }
     else {
         if (gradient) stream << "maxSpeed " << maxSpeed << ", ";
@@ -192,39 +241,106 @@ void Axis::release() {
         move(false);
         isDown = false;
     }
+    //and stop moving the mouse / pulsing the key on our own.
+    isOn = false;
+    timer.stop();
+    disconnect(&timer, SIGNAL(timeout()), 0, 0);
+    Scheduler::instance()->cancel(this);
+    //a coalesced value still waiting is stale now, and so is the filter
+    intervalTimer.stop();
+    hasPending = false;
+    euroValid = false;
 }
 
-void Axis::jsevent( int value ) {
-    //adjust real value to throttle value
+int Axis::throttled( int value ) const {
     if (throttle == 0)
-        state = value;
+        return value;
     else if (throttle == -1)
-        state = (value + JOYMIN) / 2;
+        return (value + JOYMIN) / 2;
     else
-        state = (value + JOYMAX) / 2;
+        return (value + JOYMAX) / 2;
+}
+
+int Axis::uncorrect( int value ) const {
+    if (value < 0) return value - kernelDZoneNeg;
+    if (value > 0) return value + kernelDZonePos;
+    return 0;
+}
+
+void Axis::sync( int value ) {
+    //if the axis is already pushed, it counts as on, but nothing happens
+    //until it is let go of and pushed again.
+    state = throttled(value);
+    isOn = abs(state) >= dZone;
+}
+
+void Axis::jsevent( int value ) {
+    if (minInterval > 0) {
+        //too soon after the last one: remember the value and deal with it
+        //when the interval is over, unless an even newer one comes first.
+        if (lastEvent.isValid() && lastEvent.elapsed() < minInterval) {
+            if (hasPending) rateLimitEvents.count();
+            pendingValue = value;
+            hasPending = true;
+            if (!intervalTimer.isActive()) {
+                intervalTimer.start(minInterval - lastEvent.elapsed());
+            }
+            return;
+        }
+        //whatever was still waiting is older than this
+        intervalTimer.stop();
+        hasPending = false;
+        lastEvent.start();
+    }
+    process(value);
+}
+
+void Axis::intervalElapsed() {
+    if (!hasPending) return;
+    hasPending = false;
+    lastEvent.start();
+    process(pendingValue);
+}
+
+void Axis::process( int value ) {
+    //adjust real value to throttle value
+    state = throttled(value);
+    //nothing left to do for jitter inside the dead zone. These are the
+    //events a kernel dead zone would spare us.
+    if (!isOn && abs(state) < dZone) {
+        deadZoneEvents.count();
+        return;
+    }
     //set isOn, deal with state changing.
     //if was on but now should be off:
-    if (isOn && abs(state) <= dZone) {
+    if (isOn && abs(state) <= std::max(dZone - hysteresis, 0)) {
         isOn = false;
         if (gradient) {
-            duration = 0;
             release();
-            timer.stop();
-            disconnect(&timer, SIGNAL(timeout()), 0, 0);
-            tick = 0;
         }
     }
     //if was off but now should be on:
     else if (!isOn && abs(state) >= dZone) {
         isOn = true;
-        if (gradient) {
-            duration = (abs(state) * FREQ) / JOYMAX;
+        if (gradient && mode == Keyboard) {
+            //the first pulse starts right away
+            cycleStart = Scheduler::now();
+            pwmRise();
+        }
+        else if (gradient) {
+            euroValid = false;
             connect(&timer, SIGNAL(timeout()), this, SLOT(timerCalled()));
             timer.start(MSEC);
         }
     }
     //otherwise, state doesn't change! Don't touch it.
-    else return;
+    else {
+        //this one would have turned the axis off without the hysteresis
+        if (isOn && abs(state) <= dZone) hysteresisEvents.count();
+        //a pulse that is going on gets its new length right away
+        if (isOn && gradient && mode == Keyboard) pwmDutyChanged();
+        return;
+    }
 
     //gradient will trigger movement on its own via timer().
     //non-gradient needs to be told to move.
@@ -241,13 +357,21 @@ void Axis::toDefault() {
     transferCurve = Quadratic;
 	sensitivity = 1.0F;
     dZone = DZONE;
-    tick = 0;
     xZone = XZONE;
     mode = Keyboard;
     pkeycode = 0;
     nkeycode = 0;
+    pmodifiers.clear();
+    nmodifiers.clear();
     puseMouse = false;
     nuseMouse = false;
+    kernelDZone = false;
+    pwmPeriod = PWMPERIOD;
+    pwmSteps = PWMSTEPS;
+    hysteresis = 0;
+    euroMinCutoff = 0;
+    euroBeta = 0;
+    minInterval = 0;
     downkey = 0;
     state = 0;
     adjustGradient();
@@ -262,8 +386,16 @@ bool Axis::isDefault() {
            (mode == Keyboard) &&
            (pkeycode == 0) &&
            (nkeycode == 0) &&
+           pmodifiers.isEmpty() &&
+           nmodifiers.isEmpty() &&
            (puseMouse == false) &&
-           (nuseMouse == false) ;
+           (nuseMouse == false) &&
+           (kernelDZone == false) &&
+           (pwmPeriod == PWMPERIOD) &&
+           (pwmSteps == PWMSTEPS) &&
+           (hysteresis == 0) &&
+           (euroMinCutoff == 0) &&
+           (minInterval == 0) ;
 }
 
 QString Axis::getName() {
@@ -271,14 +403,7 @@ QString Axis::getName() {
 }
 
 bool Axis::inDeadZone( int val ) {
-    int value;
-    if (throttle == 0)
-        value = val;
-    else if (throttle == -1)
-        value = (val + JOYMIN) / 2;
-    else
-        value = (val + JOYMAX) / 2;
-    return (abs(value) < dZone);
+    return (abs(throttled(val)) < dZone);
 }
 
 QString Axis::status() {
@@ -313,37 +438,114 @@ void Axis::setKey(bool useMouse, bool positive, int value) {
     if (positive) {
         pkeycode = value;
         puseMouse = useMouse;
+        pmodifiers.clear();
     }
     else {
         nkeycode = value;
         nuseMouse = useMouse;
+        nmodifiers.clear();
     }
 }
 
-void Axis::timerTick( int tick ) {
-    if (isOn) {
-        if (mode == Keyboard) {
-            if (tick % FREQ == 0)
-            {
-                if (duration == FREQ)
-                {
-                    if (!isDown) move(true);
-                    duration = (abs(state) * FREQ) / JOYMAX;
-                    return;
-                }
-                move(true);
-            }
-            if (tick % FREQ == duration) {
-                move(false);
-                duration = (abs(state) * FREQ) / JOYMAX;
-            }
-        }
-        else {
-            move(true);
-        }
+void Axis::timerTick() {
+    if (isOn && mode != Keyboard) {
+        if (euroMinCutoff > 0) smooth();
+        move(true);
     }
 }
 
+qint64 Axis::pwmDownTime() const {
+    //the key is down for as many of the pwmSteps steps of the period as
+    //the axis is pushed, all of them at JOYMAX.
+    const int level = std::min(abs(state) * pwmSteps / JOYMAX, pwmSteps);
+    return (qint64) pwmPeriod * 1000 * level / pwmSteps;
+}
+
+void Axis::pwmRise() {
+    //a pulse starts at cycleStart and is as long as the axis says now.
+    const qint64 period = (qint64) pwmPeriod * 1000;
+    const qint64 down = pwmDownTime();
+    //a whole pulse can be timed by the X server. Changes of the duty
+    //cycle then only take effect with the next period.
+    if (down > 0 && down < period && !isDown &&
+        sendpulse((state > 0) ? puseMouse : nuseMouse, (state > 0) ? pkeycode : nkeycode, down,
+                  (state > 0) ? pmodifiers : nmodifiers)) {
+        Scheduler::instance()->schedule(this, cycleStart + period);
+        return;
+    }
+    if (down > 0) {
+        if (!isDown) move(true);
+    }
+    else if (isDown) {
+        move(false);
+    }
+    //at full duty the key just stays down into the next period
+    if (down > 0 && down < period) {
+        Scheduler::instance()->schedule(this, cycleStart + down);
+    }
+    else {
+        Scheduler::instance()->schedule(this, cycleStart + period);
+    }
+}
+
+void Axis::pwmDutyChanged() {
+    //only a pulse that is still going on can be made longer or shorter,
+    //a key that is up waits for the next period.
+    if (!isDown) return;
+    const qint64 period = (qint64) pwmPeriod * 1000;
+    const qint64 down = pwmDownTime();
+    if (down >= period) {
+        Scheduler::instance()->schedule(this, cycleStart + period);
+    }
+    else if (cycleStart + down <= Scheduler::now()) {
+        move(false);
+        Scheduler::instance()->schedule(this, cycleStart + period);
+    }
+    else {
+        Scheduler::instance()->schedule(this, cycleStart + down);
+    }
+}
+
+void Axis::timeout( qint64 due ) {
+    if (!isOn || !gradient || mode != Keyboard) return;
+    const qint64 period = (qint64) pwmPeriod * 1000;
+    if (due >= cycleStart + period) {
+        //the next period starts exactly where the last one ended, unless
+        //we've fallen a whole period behind; then don't try to catch up.
+        cycleStart += period;
+        if (Scheduler::now() - cycleStart >= period) cycleStart = Scheduler::now();
+        pwmRise();
+    }
+    else {
+        //the end of a pulse
+        move(false);
+        Scheduler::instance()->schedule(this, cycleStart + period);
+    }
+}
+
+void Axis::smooth() {
+    //the 1€ filter (Casiez, Roussel, Vogel 2012), sampled once per tick.
+    //Ticking keeps it converging while the stick rests and sends no events.
+    const float dt = MSEC / 1000.0F;
+    if (!euroValid) {
+        euroRaw = euroValue = state;
+        euroDeriv = 0;
+        euroValid = true;
+        return;
+    }
+    //the speed is smoothed with a fixed 1 Hz cutoff, as the paper suggests
+    euroDeriv += lowPassAlpha(1.0F, dt) * ((state - euroRaw) / dt - euroDeriv);
+    euroRaw = state;
+    const float cutoff = euroMinCutoff + euroBeta * fabsf(euroDeriv);
+    euroValue += lowPassAlpha(cutoff, dt) * (state - euroValue);
+    euroCorrection.add(abs(state - mouseState()));
+}
+
+int Axis::mouseState() const {
+    if (euroMinCutoff > 0 && euroValid) return static_cast<int>(rint(euroValue));
+    return state;
+}
+
 void Axis::adjustGradient() {
 	inverseRange = 1.0F / (xZone - dZone);
 	// This is also the convenient spot to initialize the dithering
@@ -351,6 +553,21 @@ void Axis::adjustGradient() {
     sumDist = 0;
 }
 
+float Axis::transfer( unsigned int curve, float u, float sensitivity ) {
+    switch(curve) {
+    case Quadratic:
+        return sqr(u);
+    case Cubic:
+        return cub(u);
+    case QuadraticExtreme:
+        return u >= 0.95F ? sqr(u) * 1.5F : sqr(u);
+    case PowerFunction:
+        return clamp(powf(u, 1.0F / clamp(sensitivity, 1e-8F, 1e+3F)), 0.0F, 1.0F);
+    default:
+        return u;
+    }
+}
+
 void Axis::move( bool press ) {
     FakeEvent e;
     if (mode == Keyboard) {
@@ -363,48 +580,29 @@ void Axis::move( bool press ) {
         if (press) {
             e.type = useMouse ? FakeEvent::MouseDown : FakeEvent::KeyDown;
             downkey = (state > 0)?pkeycode:nkeycode;
+            downModifiers = (state > 0)?pmodifiers:nmodifiers;
         }
         else {
             e.type = useMouse ? FakeEvent::MouseUp : FakeEvent::KeyUp;
         }
         e.keycode = downkey;
+        sendchord(e, downModifiers);
+        return;
     }
     //if using the mouse
     else if (press) {
         int dist;
 
  		if (gradient) {
-			const int absState = abs(state);
+			const int position = mouseState();
+			const int absState = abs(position);
 			float fdist;	// Floating point movement distance
 
 			if (absState >= xZone) fdist = 1.0F;
 			else if (absState <= dZone) fdist = 0.0F;
-			else {
-				const float u = inverseRange * (absState - dZone);
-
-				switch(transferCurve) {
-				case Quadratic:
-					fdist = sqr(u);
-					break;
-				case Cubic:
-					fdist = cub(u);
-					break;
-				case QuadraticExtreme:
-					fdist = sqr(u);
-					if(u >= 0.95F) {
-						fdist *= 1.5F;
-					}
-					break;
-				case PowerFunction:
-					fdist = clamp(powf(u, 1.0F / clamp(
-						sensitivity, 1e-8F, 1e+3F)), 0.0F, 1.0F);
-					break;
-				default:
-					fdist = u;
-				}
-			}
+			else fdist = transfer(transferCurve, inverseRange * (absState - dZone), sensitivity);
 			fdist *= maxSpeed;
-			if (state < 0) fdist = -fdist;
+			if (position < 0) fdist = -fdist;
 			// Accumulate the floating point distance and shift the
 			// mouse by the rounded magnitude
 			sumDist += fdist;
@@ -6,29 +6,48 @@
 #include <math.h>
 
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QTextStream>
 #include <QRegExp>
 #include <QStringList>
+#include <QVector>
 #include "constant.h"
 #include "error.h"
+#include "scheduler.h"
 
 //default and arbitrary values for dZone and xZone
 #define DZONE 3000
 #define XZONE 30000
+//longest minimum interval between two events of an axis, in milliseconds
+#define MAXINTERVAL 1000
+//highest cutoff frequency of the 1€ filter, in Hz
+#define MAXCUTOFF 100.0F
+//default period (msec) and number of duty levels of keyboard gradient pulses,
+//the same as the fixed FREQ * MSEC ticks used to be
+#define PWMPERIOD (FREQ * MSEC)
+#define PWMSTEPS FREQ
+#define MINPWMPERIOD 5
+#define MAXPWMPERIOD 1000
+#define MAXPWMSTEPS 100
 
 
 //represents one joystick axis
-class Axis : public QObject {
+class Axis : public QObject, public Timed {
     Q_OBJECT
 
     //each axis can create a key press or move the mouse in one of four directions.
     enum Mode {Keyboard, MousePosVert, MouseNegVert, MousePosHor, MouseNegHor};
-    enum TransferCurve {Linear, Quadratic, Cubic, QuadraticExtreme,
-                        PowerFunction};
 
     //so AxisEdit can manipulate fields directly.
 	friend class AxisEdit;
+	//and Calibration can propose better ones
+	friend class Calibration;
 	public:
+		enum TransferCurve {Linear, Quadratic, Cubic, QuadraticExtreme,
+		                    PowerFunction};
+		//how fast the mouse goes (0..1) when pushed u (0..1) of the way
+		//from the dead zone to the extreme zone
+		static float transfer( unsigned int curve, float u, float sensitivity );
 		Axis( int i, QObject *parent = 0 );
 		~Axis();
 		//read axis settings from a stream
@@ -39,10 +58,15 @@ class Axis : public QObject {
 		void release();
 		//pass a message from the joystick device to this axis object
 		void jsevent( int value );
+		//take on the initial state reported when the device is opened,
+		//without generating any events
+		void sync( int value );
 		//revert to default settings
 		void toDefault();
 		//True iff currently at defaults
 		bool isDefault();
+		//true while the axis is out of its dead zone and doing something
+		bool isActive() const { return isOn; }
 		QString getName();
 		//true iff the given value is in the dead zone for this axis.
 		bool inDeadZone( int val );
@@ -51,15 +75,37 @@ class Axis : public QObject {
 		//set the key code for this axis. Used by quickset.
 		void setKey(bool positive, int value);
 		void setKey(bool useMouse, bool positive, int value);
-		//happens every MSEC milliseconds (constant.h)
-		//uses tick to decide if key events should be generated
-		void timerTick( int tick );
+		//happens every MSEC milliseconds (constant.h) while a gradient axis
+		//moves the mouse
+		void timerTick();
+		//the next edge of a keyboard gradient pulse is due
+		void timeout( qint64 due );
 		//recalculates the gradient curve. This should be run every time
 		//maxSpeed, xZone, or dZone are changed.
 		void adjustGradient();
         int axisIndex() const { return index; }
+		//the dead zone joydev should apply to this axis, 0 for none. Only
+		//a centered (non-throttle) dead zone can be done in the kernel.
+		int wantedKernelDZone() const { return (kernelDZone && throttle == 0) ? dZone : 0; }
+		//how far joydev shifted negative / positive values to make room for
+		//the dead zone it applies; 0 and 0 if it doesn't.
+		void setKernelDZone( int neg, int pos ) { kernelDZoneNeg = neg; kernelDZonePos = pos; }
+		//turn a value corrected by joydev back into the plain value
+		int uncorrect( int value ) const;
 	protected:
-        int tick;
+		//what jsevent does once the value got past the rate limit
+		void process( int value );
+		//advance the 1€ filter by one timer tick
+		void smooth();
+		//the position mouse movement is based on, smoothed if the 1€
+		//filter is on
+		int mouseState() const;
+		//keyboard gradient: start the pulse of the period at cycleStart
+		void pwmRise();
+		//keyboard gradient: the axis moved, move the end of the pulse
+		void pwmDutyChanged();
+		//how long the key is down each period at the current state, usec
+		qint64 pwmDownTime() const;
         //This axis is logically depressed (positive or negative)
 		//if the axis is gradient, this is true even if it is not
 		//currently generating a keypress at the instant.
@@ -69,6 +115,8 @@ class Axis : public QObject {
 		//actually sends key events. Press is true iff the key
 		//is to be depressed as opposed to released.
 		virtual void move( bool press );
+		//adjust real value to throttle value
+		int throttled( int value ) const;
 		//is a key currently depressed?
 		bool isDown;
 
@@ -91,17 +139,54 @@ class Axis : public QObject {
 		int nkeycode;
 		bool puseMouse;
 		bool nuseMouse;
-		//the key that is currently pressed
+		//keys pressed before pkeycode / nkeycode and released after it
+		QVector<int> pmodifiers;
+		QVector<int> nmodifiers;
+		//let joydev drop the jitter inside the dead zone, so it never
+		//wakes us up
+		bool kernelDZone;
+		int kernelDZoneNeg;
+		int kernelDZonePos;
+		//the filter stage in front of all of the above, everything off by
+		//default. Once on, the axis only turns off again at or below
+		//dZone - hysteresis, so a value hovering around dZone doesn't
+		//chatter.
+		int hysteresis;
+		//1€ filter for the mouse modes: a low pass whose cutoff rises from
+		//euroMinCutoff (Hz, 0 = off) by euroBeta per unit/s of speed, so a
+		//resting stick is smoothed a lot and a moving one hardly lags.
+		float euroMinCutoff;
+		float euroBeta;
+		float euroRaw;
+		float euroValue;
+		float euroDeriv;
+		bool euroValid;
+		//events closer together than minInterval msec are coalesced into
+		//the last of them, 0 for no limit.
+		int minInterval;
+		int pendingValue;
+		bool hasPending;
+		QElapsedTimer lastEvent;
+		QTimer intervalTimer;
+		//the key that is currently pressed, and its modifiers
 		int downkey;
+		QVector<int> downModifiers;
 		//the position of the axis, as from jsevent
 		int state;
-		//how long a key should stay down when in gradient mode
-		//note, the key is still clicked at the same pace no matter what,
-		//this just decides how long it stays down each cycle.
-		int duration;
+		//in keyboard gradient mode, the key is pressed every pwmPeriod msec
+		//and stays down for a part of it. How big a part depends on how far
+		//the axis is pushed, in pwmSteps steps.
+		int pwmPeriod;
+		int pwmSteps;
+		//when the current period started (Scheduler::now() time)
+		qint64 cycleStart;
         QTimer timer;
     public slots:
         void timerCalled();
+        void intervalElapsed();
+    signals:
+        //the settings were edited
+        void changed();
 };
 
 #endif
@@ -28,6 +28,12 @@ AxisEdit::AxisEdit( Axis* ax )
     connect(chkGradient, SIGNAL(toggled(bool)), this, SLOT( gradientChanged( bool )));
     v2->addWidget(chkGradient);
 
+    chkKernelDZone = new QCheckBox(tr("&Dead zone in kernel"), this);
+    chkKernelDZone->setToolTip(tr("Let the joystick driver drop the jitter inside the dead zone.\n"
+                                  "Applies to the device as a whole, not only to QJoyPad."));
+    chkKernelDZone->setChecked(axis->kernelDZone);
+    v2->addWidget(chkKernelDZone);
+
     cmbMode = new QComboBox(this);
     cmbMode->insertItem((int) Axis::Keyboard, tr("Keyboard/Mouse Button"), Qt::DisplayRole);
     cmbMode->insertItem((int) Axis::MousePosVert, tr("Mouse (Vert.)"),Qt::DisplayRole);
@@ -69,14 +75,85 @@ AxisEdit::AxisEdit( Axis* ax )
     spinSensitivity->setSingleStep(0.10);
     spinSensitivity->setValue(axis->sensitivity);
     v2->addWidget(spinSensitivity);
+    QLabel *cutoffLabel = new QLabel(tr("Smoothing &cutoff (Hz)"), mouseBox);
+    v2->addWidget(cutoffLabel);
+    spinCutoff = new QDoubleSpinBox(mouseBox);
+    spinCutoff->setRange(0, MAXCUTOFF);
+    spinCutoff->setSingleStep(0.5);
+    spinCutoff->setSpecialValueText(tr("Off"));
+    spinCutoff->setToolTip(tr("1€ filter: the lower, the steadier the mouse\n"
+                              "when the stick is held still. 0 turns it off."));
+    spinCutoff->setValue(axis->euroMinCutoff);
+    v2->addWidget(spinCutoff);
+    QLabel *betaLabel = new QLabel(tr("Smoothing &beta"), mouseBox);
+    v2->addWidget(betaLabel);
+    spinBeta = new QDoubleSpinBox(mouseBox);
+    spinBeta->setRange(0, 1);
+    spinBeta->setDecimals(4);
+    spinBeta->setSingleStep(0.0005);
+    spinBeta->setToolTip(tr("1€ filter: the higher, the less lag\n"
+                            "when the stick moves fast."));
+    spinBeta->setValue(axis->euroBeta);
+    v2->addWidget(spinBeta);
     h->addWidget(mouseBox);
     mouseLabel->setBuddy(spinSpeed);
     lblSensitivity->setBuddy(spinSensitivity);
+    cutoffLabel->setBuddy(spinCutoff);
+    betaLabel->setBuddy(spinBeta);
     v->addLayout(h);
 
     slider = new JoySlider(axis->dZone, axis->xZone, axis->state, this);
     v->addWidget(slider);
 
+    h = new QHBoxLayout();
+    h->setSpacing(5);
+    QLabel *hysteresisLabel = new QLabel(tr("&Hysteresis"), this);
+    h->addWidget(hysteresisLabel);
+    spinHysteresis = new QSpinBox(this);
+    spinHysteresis->setRange(0, JOYMAX);
+    spinHysteresis->setSingleStep(100);
+    spinHysteresis->setToolTip(tr("Once pushed past the dead zone, the axis is only\n"
+                                  "let go of this much further inside it."));
+    spinHysteresis->setValue(axis->hysteresis);
+    h->addWidget(spinHysteresis);
+    hysteresisLabel->setBuddy(spinHysteresis);
+    QLabel *intervalLabel = new QLabel(tr("Min. &interval"), this);
+    h->addWidget(intervalLabel);
+    spinInterval = new QSpinBox(this);
+    spinInterval->setRange(0, MAXINTERVAL);
+    spinInterval->setSuffix(tr(" ms"));
+    spinInterval->setSpecialValueText(tr("None"));
+    spinInterval->setToolTip(tr("Movements closer together than this are\n"
+                                "merged into the last one."));
+    spinInterval->setValue(axis->minInterval);
+    h->addWidget(spinInterval);
+    intervalLabel->setBuddy(spinInterval);
+    v->addLayout(h);
+
+    pwmBox = new QFrame(this);
+    h = new QHBoxLayout(pwmBox);
+    h->setSpacing(5);
+    h->setMargin(0);
+    QLabel *pwmPeriodLabel = new QLabel(tr("Pulse &period"), pwmBox);
+    h->addWidget(pwmPeriodLabel);
+    spinPwmPeriod = new QSpinBox(pwmBox);
+    spinPwmPeriod->setRange(MINPWMPERIOD, MAXPWMPERIOD);
+    spinPwmPeriod->setSuffix(tr(" ms"));
+    spinPwmPeriod->setToolTip(tr("A gradient axis presses its key once every period\n"
+                                 "and holds it for as much of it as the axis is pushed."));
+    spinPwmPeriod->setValue(axis->pwmPeriod);
+    h->addWidget(spinPwmPeriod);
+    pwmPeriodLabel->setBuddy(spinPwmPeriod);
+    QLabel *pwmStepsLabel = new QLabel(tr("S&teps"), pwmBox);
+    h->addWidget(pwmStepsLabel);
+    spinPwmSteps = new QSpinBox(pwmBox);
+    spinPwmSteps->setRange(1, MAXPWMSTEPS);
+    spinPwmSteps->setToolTip(tr("How many different lengths the key can be held for."));
+    spinPwmSteps->setValue(axis->pwmSteps);
+    h->addWidget(spinPwmSteps);
+    pwmStepsLabel->setBuddy(spinPwmSteps);
+    v->addWidget(pwmBox);
+
     keyBox = new QFrame(this);
     keyBox->setFrameStyle( QFrame::Box | QFrame::Sunken );
     h = new QHBoxLayout(keyBox);
@@ -118,6 +195,7 @@ void AxisEdit::setState( int val ) {
 }
 void AxisEdit::gradientChanged( bool on ) {
     cmbTransferCurve->setEnabled(on);
+    updatePwmBox();
 	if (on) {
         transferCurveChanged( axis->transferCurve );
 	}
@@ -128,6 +206,7 @@ void AxisEdit::gradientChanged( bool on ) {
 }
 
 void AxisEdit::modeChanged( int index ) {
+    updatePwmBox();
     if (index == Axis::Keyboard) {
         mouseBox->setEnabled(false);
         keyBox->setEnabled(true);
@@ -142,6 +221,10 @@ void AxisEdit::modeChanged( int index ) {
 	}
 }
 
+void AxisEdit::updatePwmBox() {
+    pwmBox->setEnabled(chkGradient->isChecked() && cmbMode->currentIndex() == Axis::Keyboard);
+}
+
 void AxisEdit::transferCurveChanged( int index ) {
     if (index == Axis::PowerFunction) {
         lblSensitivity->setEnabled(true);
@@ -169,6 +252,8 @@ void AxisEdit::throttleChanged( int index ) {
         break;
     }
     slider->setThrottle( index - 1 );
+    //joydev's dead zone is always centered
+    chkKernelDZone->setEnabled( index == 1 );
 }
 
 void AxisEdit::accept() {
@@ -180,11 +265,26 @@ void AxisEdit::accept() {
     axis->dZone = slider->deadZone();
     axis->xZone = slider->xZone();
     axis->mode = (Axis::Mode) cmbMode->currentIndex();
+    //a different key doesn't keep the modifiers of the old one
+    if (btnPos->choseMouse() != axis->puseMouse || btnPos->getValue() != axis->pkeycode) {
+        axis->pmodifiers.clear();
+    }
+    if (btnNeg->choseMouse() != axis->nuseMouse || btnNeg->getValue() != axis->nkeycode) {
+        axis->nmodifiers.clear();
+    }
     axis->pkeycode = btnPos->getValue();
     axis->nkeycode = btnNeg->getValue();
     axis->puseMouse = btnPos->choseMouse();
     axis->nuseMouse = btnNeg->choseMouse();
+    axis->kernelDZone = chkKernelDZone->isChecked();
+    axis->hysteresis = spinHysteresis->value();
+    axis->minInterval = spinInterval->value();
+    axis->euroMinCutoff = spinCutoff->value();
+    axis->euroBeta = spinBeta->value();
+    axis->pwmPeriod = spinPwmPeriod->value();
+    axis->pwmSteps = spinPwmSteps->value();
     axis->adjustGradient();
+    emit axis->changed();
 
     QDialog::accept();
 }
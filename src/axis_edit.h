@@ -30,15 +30,19 @@ class AxisEdit : public QDialog {
 		void throttleChanged( int index );
 		void accept();
 	protected:
+		//pulses only matter for gradient keyboard axes
+		void updatePwmBox();
 		//the associated Axis that needs to be set.
 		Axis *axis;
 		//the important parts of the dialog:
-		QCheckBox *chkGradient;
+		QCheckBox *chkGradient, *chkKernelDZone;
 		QComboBox *cmbMode, *cmbThrottle, *cmbTransferCurve;
 		QFrame *mouseBox, *keyBox;
-		QSpinBox *spinSpeed;
+		QSpinBox *spinSpeed, *spinHysteresis, *spinInterval;
+		QFrame *pwmBox;
+		QSpinBox *spinPwmPeriod, *spinPwmSteps;
 		QLabel *lblSensitivity;
-		QDoubleSpinBox *spinSensitivity;
+		QDoubleSpinBox *spinSensitivity, *spinCutoff, *spinBeta;
 		KeyButton *btnNeg, *btnPos;
 		JoySlider *slider;
 };
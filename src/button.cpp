@@ -1,13 +1,25 @@
 #include "button.h"
 #include "event.h"
+#include "keymap.h"
+#include "stats.h"
+
+static Stat turboPresses("Rapid fire presses");
+static Stat turboError("Rapid fire period error", " us");
 
 Button::Button( int i, QObject *parent ) : QObject(parent) {
     index = i;
     isButtonPressed = false;
     isDown = false;
+    downUseMouse = false;
+    downKeycode = 0;
+    tapState = TapIdle;
+    pressPending = false;
+    pressTime = releaseTime = 0;
+    holdDue = 0;
     rapidfire = false;
+    turboStart = 0;
+    lastTurboStart = -1;
     toDefault();
-    tick = 0;
 }
 
 Button::~Button() {
@@ -29,32 +41,86 @@ bool Button::read( QTextStream &stream ) {
 
     //go through every word on the line describing this button.
     for ( QStringList::Iterator it = words.begin(); it != words.end(); ++it ) {
-        if (*it == "mouse") {
+        //"key 0x74", or with modifiers pressed before it
+        //"key 0xffe3+0xffe1+0x74"
+        if (*it == "mouse" || *it == "key") {
+            useMouse = (*it == "mouse");
+            ++it;
+            if (it == words.end()) return false;
+            if (!readchord(*it, useMouse, modifiers, keycode)) return false;
+        }
+        else if (*it == "rapidfire") {
+            rapidfire = true;
+        }
+        //rapidfire presses per second
+        else if (*it == "rate") {
             ++it;
             if (it == words.end()) return false;
             val = (*it).toInt(&ok);
-            if (ok && val >= 0 && val <= MAXKEY) {
-                useMouse = true;
-                keycode = val;
-            }
+            if (ok && val >= 1 && val <= MAXTURBORATE) turboRate = val;
             else return false;
         }
-        else if (*it == "key") {
+        //percentage of the time the key is down during rapidfire
+        else if (*it == "duty") {
             ++it;
             if (it == words.end()) return false;
             val = (*it).toInt(&ok);
-            if (ok && val >= 0 && val <= MAXKEY) {
-                useMouse = false;
-                keycode = val;
-            }
+            if (ok && val >= 1 && val <= 99) turboDuty = val;
             else return false;
         }
-        else if (*it == "rapidfire") {
-            rapidfire = true;
+        //macro keyDown 0x61 wait 16 keyDown 0x62 keyUp 0x61 keyUp 0x62 end
+        else if (*it == "macro") {
+            if (!macro.read(it, words.end())) return false;
+        }
+        //run the macro again and again while the button is held
+        else if (*it == "macrorepeat") {
+            macro.repeat = true;
+        }
+        //stop the macro when the button is let go of
+        else if (*it == "macrocancel") {
+            macro.cancel = true;
         }
         else if (*it == "sticky") {
             sticky = true;
         }
+        //how long the button has to be held for the hold key
+        else if (*it == "holdtime") {
+            ++it;
+            if (it == words.end()) return false;
+            val = (*it).toInt(&ok);
+            if (ok && val >= 0 && val <= MAXTAPTIME) holdTime = val;
+            else return false;
+        }
+        else if (*it == "holdkey" || *it == "holdmouse") {
+            holdUseMouse = (*it == "holdmouse");
+            ++it;
+            if (it == words.end()) return false;
+            if (holdUseMouse) {
+                val = (*it).toInt(&ok);
+                if (ok && val >= 0 && val <= MAXKEY) holdKeycode = val;
+                else return false;
+            }
+            else if (!readkey(*it, holdKeycode)) return false;
+        }
+        //how soon after a tap the button has to be pressed for the double key
+        else if (*it == "doubletime") {
+            ++it;
+            if (it == words.end()) return false;
+            val = (*it).toInt(&ok);
+            if (ok && val >= 0 && val <= MAXTAPTIME) doubleTime = val;
+            else return false;
+        }
+        else if (*it == "doublekey" || *it == "doublemouse") {
+            doubleUseMouse = (*it == "doublemouse");
+            ++it;
+            if (it == words.end()) return false;
+            if (doubleUseMouse) {
+                val = (*it).toInt(&ok);
+                if (ok && val >= 0 && val <= MAXKEY) doubleKeycode = val;
+                else return false;
+            }
+            else if (!readkey(*it, doubleKeycode)) return false;
+        }
     }
     return true;
 }
@@ -62,19 +128,57 @@ bool Button::read( QTextStream &stream ) {
 void Button::write( QTextStream &stream ) {
     stream << "\tButton " << (index+1) << ": ";
     if (rapidfire) stream << "rapidfire, ";
+    if (turboRate != TURBORATE) stream << "rate " << turboRate << ", ";
+    if (turboDuty != TURBODUTY) stream << "duty " << turboDuty << ", ";
     if (sticky) stream << "sticky, ";
-    stream << (useMouse ? "mouse " : "key ") << keycode << "\n";
+    if (!macro.isEmpty()) {
+        macro.write(stream);
+        stream << ", ";
+        if (macro.repeat) stream << "macroRepeat, ";
+        if (macro.cancel) stream << "macroCancel, ";
+    }
+    if (holdTime != 0) {
+        stream << "holdTime " << holdTime << ", "
+               << (holdUseMouse ? "holdMouse " : "holdKey ")
+               << (holdUseMouse ? QString::number(holdKeycode) : writekey(holdKeycode)) << ", ";
+    }
+    if (doubleTime != 0) {
+        stream << "doubleTime " << doubleTime << ", "
+               << (doubleUseMouse ? "doubleMouse " : "doubleKey ")
+               << (doubleUseMouse ? QString::number(doubleKeycode) : writekey(doubleKeycode)) << ", ";
+    }
+    stream << (useMouse ? "mouse " : "key ") << writechord(modifiers, useMouse, keycode) << "\n";
 }
 
 void Button::release() {
     if (isDown) {
         click(false);
-        isDown = true;
     }
+    macro.stop();
+    //forget about the physical button too, or rapidfire would go on
+    isButtonPressed = false;
+    tapState = TapIdle;
+    pressPending = false;
+    Scheduler::instance()->cancel(this);
 }
 
-void Button::jsevent( int value ) {
+void Button::jsevent( int value, quint32 time ) {
     bool newval = (value == 1);
+    //a macro takes over from everything else
+    if (!macro.isEmpty()) {
+        if (newval == isButtonPressed) return;
+        isButtonPressed = newval;
+        if (isButtonPressed) macro.start();
+        else macro.letGo();
+        return;
+    }
+    //tap/hold/double tap take over from sticky and rapidfire
+    if (holdTime > 0 || doubleTime > 0) {
+        if (newval == isButtonPressed) return;
+        isButtonPressed = newval;
+        tapEvent(time);
+        return;
+    }
     if (sticky) {
         //the state of a sticky key only changes on button press, not button release.
         if (value == 1) {
@@ -85,42 +189,75 @@ void Button::jsevent( int value ) {
     //if the received event indicates a change in state,
     else if (newval != isButtonPressed) {
         isButtonPressed = newval; //change state
-        if (isButtonPressed && rapidfire) {
-            tick = 0;
-            connect(&timer, SIGNAL(timeout()), this, SLOT(timerCalled()));
-            timer.start(MSEC);
-        }
-        if (!isButtonPressed && rapidfire) {
-            timer.stop();
-            disconnect(&timer, SIGNAL(timeout()), 0, 0);
+    }
+    //otherwise... we don't care. This shouldn't happen.
+    else return;
+    //if rapidfire is on, then timeout() will do its job, sticky or not.
+    //Otherwise we must manually triger the key event.
+    if (rapidfire) {
+        if (isButtonPressed) {
+            //the first shot goes off right away
+            turboStart = Scheduler::now();
+            lastTurboStart = -1;
+            turboRise();
+        }
+        else {
+            Scheduler::instance()->cancel(this);
             if(isDown) {
                 click(false);
             }
-            tick = 0;
         }
     }
-    //otherwise... we don't care. This shouldn't happen.
-    else return;
-    //if rapidfire is on, then timer() will do its job. Otherwise we must
-    //manually triger the key event.
-    if (!rapidfire) {
+    else {
         click(isButtonPressed);
     }
 }
 
+void Button::sync( int value ) {
+    //a sticky button only changes on presses, and this is no press.
+    if (!sticky) {
+        isButtonPressed = (value == 1);
+    }
+}
+
+void Button::resync( int value, quint32 time ) {
+    //a state is no press, it must not toggle a sticky button.
+    if (!sticky) {
+        jsevent(value, time);
+    }
+}
+
 void Button::toDefault() {
     rapidfire = false;
+    turboRate = TURBORATE;
+    turboDuty = TURBODUTY;
     sticky = false;
     useMouse = false;
     keycode = 0;
-    timer.stop();
+    modifiers.clear();
+    holdTime = 0;
+    holdUseMouse = false;
+    holdKeycode = 0;
+    doubleTime = 0;
+    doubleUseMouse = false;
+    doubleKeycode = 0;
+    macro.clear();
+    tapState = TapIdle;
+    pressPending = false;
+    Scheduler::instance()->cancel(this);
 }
 
 bool Button::isDefault() {
     return	(rapidfire == false) &&
+           (turboRate == TURBORATE) &&
+           (turboDuty == TURBODUTY) &&
            (sticky == false) &&
            (useMouse == false) &&
-           (keycode == 0);
+           (keycode == 0) &&
+           modifiers.isEmpty() &&
+           (holdTime == 0) &&
+           (doubleTime == 0) &&
+           macro.isEmpty();
 }
 
 QString Button::getName() {
@@ -128,45 +265,215 @@ QString Button::getName() {
 }
 
 QString Button::status() {
+    if (!macro.isEmpty()) {
+        return tr("%1 : Macro").arg(getName());
+    }
+    QString mods;
+    foreach (int mod, modifiers) mods += ktos(mod) + "+";
     if (useMouse) {
-        return tr("%1 : Mouse %2").arg(getName()).arg(keycode);
+        return tr("%1 : %2").arg(getName(), mods + tr("Mouse %1").arg(keycode));
     }
     else {
-        return tr("%1 : %2").arg(getName(), ktos(keycode));
+        return tr("%1 : %2").arg(getName(), mods + ktos(keycode));
     }
 }
 
 void Button::setKey( bool mouse, int value ) {
     useMouse = mouse;
     keycode = value;
+    modifiers.clear();
+}
+
+qint64 Button::turboPeriod() const {
+    return 1000000 / turboRate;
+}
+
+qint64 Button::turboDownTime() const {
+    //originally I just clicked true and then false right after, but this
+    //was not recognized by some programs. There has to be a delay in
+    //between, and after the release too.
+    const qint64 period = turboPeriod();
+    const qint64 down = period * turboDuty / 100;
+    if (down < MINTURBOPHASE) return MINTURBOPHASE;
+    if (down > period - MINTURBOPHASE) return period - MINTURBOPHASE;
+    return down;
 }
 
-void Button::timerTick( int tick ) {
+void Button::turboRise() {
+    //how far off the rate we configured we really are
+    const qint64 time = Scheduler::now();
+    if (lastTurboStart >= 0) {
+        turboError.add(time - lastTurboStart - turboPeriod());
+    }
+    lastTurboStart = time;
+    turboPresses.count();
+
+    //the release is known in advance, the X server can time it for us
+    if (sendpulse(useMouse, keycode, turboDownTime(), modifiers)) {
+        Scheduler::instance()->schedule(this, turboStart + turboPeriod());
+        return;
+    }
+    click(true);
+    Scheduler::instance()->schedule(this, turboStart + turboDownTime());
+}
+
+void Button::tapEvent( quint32 time ) {
+    //all decisions are made from the kernel's timestamps, so they come out
+    //the same even if we get to handle the events late. Only the deadlines
+    //for what happens when nothing else does are on our own clock.
+    Scheduler *scheduler = Scheduler::instance();
     if (isButtonPressed) {
-        //originally I just clicked true and then false right after, but this
-        //was not recognized by some programs. I need a delay in between.
-        if (tick % FREQ == 0) {
-            click(true);
-        }
-        if (tick % FREQ == FREQ / 2) {
+        switch (tapState) {
+        case TapPulse:
+            //let go of the last tap before anything else happens. A press
+            //that was waiting for it has been let go of already, this one
+            //takes its place.
             click(false);
+            pressPending = false;
+            break;
+        case TapReleased:
+            if ((qint32) (time - releaseTime) <= doubleTime) {
+                scheduler->cancel(this);
+                tapState = TapSecond;
+                click(true, doubleUseMouse, doubleKeycode);
+                return;
+            }
+            //too late for a double tap, the last one was a plain tap. We
+            //only get here if its deadline was late. The tap still gets its
+            //whole pulse, this press is dealt with once it is over.
+            scheduler->cancel(this);
+            tapPulse(useMouse, keycode, modifiers);
+            pressTime = time;
+            holdDue = Scheduler::fromEventTime(pressTime) + (qint64) holdTime * 1000;
+            pressPending = true;
+            return;
+        default:
+            break;
+        }
+        pressTime = time;
+        holdDue = Scheduler::fromEventTime(pressTime) + (qint64) holdTime * 1000;
+        tapPress();
+        return;
+    }
+
+    switch (tapState) {
+    case TapPressed:
+        scheduler->cancel(this);
+        releaseTime = time;
+        if (holdTime > 0 && (qint32) (time - pressTime) >= holdTime) {
+            //held long enough, but we only see it now
+            tapPulse(holdUseMouse, holdKeycode);
+        }
+        else if (doubleTime > 0) {
+            //it's a tap, but maybe the first of two
+            tapState = TapReleased;
+            scheduler->schedule(this, Scheduler::fromEventTime(releaseTime) + (qint64) doubleTime * 1000);
+        }
+        else {
+            tapPulse(useMouse, keycode, modifiers);
+        }
+        break;
+    case TapHolding:
+    case TapSecond:
+        click(false);
+        tapState = TapIdle;
+        break;
+    case TapPulse:
+        //the press that waits for the pulse is over too
+        if (pressPending) releaseTime = time;
+        break;
+    default:
+        break;
+    }
+}
+
+void Button::tapPress() {
+    tapState = TapPressed;
+    if (holdTime > 0) {
+        Scheduler::instance()->schedule(this, holdDue);
+    }
+    else {
+        Scheduler::instance()->cancel(this);
+    }
+}
+
+void Button::tapTimeout() {
+    switch (tapState) {
+    case TapPressed:
+        //a deadline that came early must not turn a tap into a hold: a
+        //press shorter than holdTime always sends the tap key
+        if (Scheduler::now() < holdDue) {
+            Scheduler::instance()->schedule(this, holdDue);
+            break;
+        }
+        //still down after holdTime
+        tapState = TapHolding;
+        click(true, holdUseMouse, holdKeycode);
+        break;
+    case TapReleased:
+        //no second tap came
+        tapPulse(useMouse, keycode, modifiers);
+        break;
+    case TapPulse:
+        click(false);
+        tapState = TapIdle;
+        if (pressPending) {
+            pressPending = false;
+            tapPress();
+            //and it may even have been let go of meanwhile
+            if (!isButtonPressed) tapEvent(releaseTime);
         }
+        break;
+    default:
+        break;
+    }
+}
+
+void Button::tapPulse( bool mouse, int code, const QVector<int> &mods ) {
+    click(true, mouse, code, mods);
+    tapState = TapPulse;
+    Scheduler::instance()->schedule(this, Scheduler::now() + TAPPULSE);
+}
+
+void Button::timeout( qint64 due ) {
+    if (holdTime > 0 || doubleTime > 0) {
+        tapTimeout();
+        return;
+    }
+    if (!isButtonPressed || !rapidfire) return;
+    const qint64 period = turboPeriod();
+    if (due >= turboStart + period) {
+        //the next period starts exactly where the last one ended, unless
+        //we've fallen a whole period behind; then don't try to catch up.
+        turboStart += period;
+        if (Scheduler::now() - turboStart >= period) turboStart = Scheduler::now();
+        turboRise();
+    }
+    else {
+        click(false);
+        Scheduler::instance()->schedule(this, turboStart + period);
     }
 }
 
 void Button::click( bool press ) {
+    click(press, useMouse, keycode, modifiers);
+}
+
+void Button::click( bool press, bool mouse, int code, const QVector<int> &mods ) {
     if (isDown == press) return;
     isDown = press;
+    if (press) {
+        downUseMouse = mouse;
+        downKeycode = code;
+        downModifiers = mods;
+    }
     FakeEvent click;
     //determine which of the four possible events we're sending.
-    if (press) click.type = useMouse ? FakeEvent::MouseDown : FakeEvent::KeyDown;
-    else click.type = useMouse ? FakeEvent::MouseUp : FakeEvent::KeyUp;
+    if (press) click.type = downUseMouse ? FakeEvent::MouseDown : FakeEvent::KeyDown;
+    else click.type = downUseMouse ? FakeEvent::MouseUp : FakeEvent::KeyUp;
     //set up the event,
-    click.keycode = keycode;
-    //and send it.
-    sendevent(click);
+    click.keycode = downKeycode;
+    //and send it, with the modifiers around it.
+    sendchord(click, downModifiers);
 }
 
-void Button::timerCalled() {
-    timerTick(++tick);
-}
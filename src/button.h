@@ -7,10 +7,27 @@
 
 //for getting a key name in status()
 #include "keycode.h"
+//for rapidfire deadlines
+#include "scheduler.h"
+//a sequence of events the button can send instead of its key
+#include "macro.h"
+
+//default rapidfire rate (Hz) and duty cycle (percent), what the fixed
+//FREQ * MSEC ticks used to give
+#define TURBORATE (1000 / (FREQ * MSEC))
+#define TURBODUTY 50
+#define MAXTURBORATE 100
+//how long a key is held down / let go of at least during rapidfire, in
+//microseconds, however the duty cycle is set. Shorter presses go unnoticed.
+#define MINTURBOPHASE 1000
+//how long the key is held for a tap, in microseconds. Like a rapidfire
+//press, long enough for games to notice.
+#define TAPPULSE 25000
+#define MAXTAPTIME 5000
 
 //note that the Button class, unlike the axis class, does not need a release
 //function because it releases the key as soon as it is pressed.
-class Button : public QObject {
+class Button : public QObject, public Timed {
 	Q_OBJECT
     friend class ButtonEdit;
 	public:
@@ -22,20 +39,28 @@ class Button : public QObject {
 		void write( QTextStream &stream );
 		//releases any pushed buttons and returns to a neutral state
 		void release();
-		//process an event from the actual joystick device
-		void jsevent( int value );
+		//process an event from the actual joystick device, time is the
+		//kernel's timestamp of it (js_event.time)
+		void jsevent( int value, quint32 time = 0 );
+		//take on the initial state reported when the device is opened,
+		//without generating any events
+		void sync( int value );
+		//catch up on the state reported after events were dropped
+		void resync( int value, quint32 time = 0 );
 		//reset default settings
 		void toDefault();
 		//True iff is currently using default settings
 		bool isDefault();
+		//true while pressed (or toggled on, if sticky)
+		bool isPressed() const { return isButtonPressed; }
 		//returns a string representation of this button.
 		QString getName();
 		//a descriptive string used as a label for the button representing this axis
 		QString status();
 		//set the key code for this axis. Used by quickset.
 		void setKey(bool mouse, int value);
-		//happens every MSEC (constant.h) milliseconds
-		void timerTick( int tick );
+		//the next edge of a rapidfire pulse is due
+		void timeout( qint64 due );
         int buttonIndex() const { return index; }
 	protected:
 		//true iff this button is physically depressed.
@@ -44,17 +69,67 @@ class Button : public QObject {
 		int index;
 		//actually sends a key press/release
 		virtual void click( bool press );
+		//the same, for another key than the button's own. A release always
+		//lets go of whatever key (and modifiers) was pressed.
+		void click( bool press, bool mouse, int code,
+		            const QVector<int> &mods = QVector<int>() );
+		//tap/hold/double tap: the button was pressed or released at the
+		//given kernel time, or a deadline came
+		void tapEvent( quint32 time );
+		void tapTimeout();
+		//a press (at pressTime, hold key due at holdDue) starts a tap,
+		//hold or double tap
+		void tapPress();
+		//press and shortly after release a key, for taps
+		void tapPulse( bool mouse, int code,
+		               const QVector<int> &mods = QVector<int>() );
 		//is a simulated key currently depressed?
 		bool isDown;
-        int tick;
+		//and which one
+		bool downUseMouse;
+		int downKeycode;
+		QVector<int> downModifiers;
+		//where the tap/hold/double tap state machine is at
+		enum TapState {TapIdle, TapPressed, TapHolding, TapReleased, TapSecond, TapPulse};
+		TapState tapState;
+		//a press that came during a tap's pulse, dealt with once it's over
+		bool pressPending;
+		//kernel timestamps of the last press / release, msec
+		quint32 pressTime;
+		quint32 releaseTime;
+		//when the hold key is due, on our clock
+		qint64 holdDue;
+		//rapidfire: press the key (again), the period starts at turboStart
+		void turboRise();
+		//rapidfire period and how long of it the key is down, usec
+		qint64 turboPeriod() const;
+		qint64 turboDownTime() const;
+		//when the current rapidfire period started / the last one did
+		//(Scheduler::now() time)
+		qint64 turboStart;
+		qint64 lastTurboStart;
 		//button settings
 		bool rapidfire;
+		int turboRate;
+		int turboDuty;
+		//if holdTime (msec) is set, holding the button at least that long
+		//presses holdKeycode instead of keycode. If doubleTime (msec) is
+		//set, pressing it again within that time after a tap presses
+		//doubleKeycode. Either one makes keycode a tap: pressed and
+		//released once it is clear that the button was only tapped.
+		int holdTime;
+		bool holdUseMouse;
+		int holdKeycode;
+		int doubleTime;
+		bool doubleUseMouse;
+		int doubleKeycode;
+		//if not empty, the button runs this instead of doing anything else
+		Macro macro;
 		bool sticky;
 		bool useMouse;
         int keycode;
-        QTimer timer;
-    public slots:
-        void timerCalled();
+		//keys pressed before keycode and released after it, as in Ctrl+T
+		QVector<int> modifiers;
 };
 
 #endif
@@ -3,6 +3,7 @@
 
 #include <QHBoxLayout>
 #include <QVBoxLayout>
+#include <QLabel>
 
 ButtonEdit::ButtonEdit(Button* butt)
         : QDialog(0) {
@@ -28,6 +29,64 @@ ButtonEdit::ButtonEdit(Button* butt)
     h->addWidget(chkRapid);
     v->addLayout(h);
 
+    h = new QHBoxLayout();
+    QLabel *rateLabel = new QLabel(tr("R&ate"), this);
+    h->addWidget(rateLabel);
+    spinRate = new QSpinBox(this);
+    spinRate->setRange(1, MAXTURBORATE);
+    spinRate->setSuffix(tr(" Hz"));
+    spinRate->setToolTip(tr("How many times per second Rapid Fire presses the key."));
+    spinRate->setValue(button->turboRate);
+    h->addWidget(spinRate);
+    rateLabel->setBuddy(spinRate);
+    QLabel *dutyLabel = new QLabel(tr("&Down"), this);
+    h->addWidget(dutyLabel);
+    spinDuty = new QSpinBox(this);
+    spinDuty->setRange(1, 99);
+    spinDuty->setSuffix(tr(" %"));
+    spinDuty->setToolTip(tr("How much of the time the key is held down.\n"
+                            "Raise this if the game misses presses."));
+    spinDuty->setValue(button->turboDuty);
+    h->addWidget(spinDuty);
+    dutyLabel->setBuddy(spinDuty);
+    v->addLayout(h);
+    spinRate->setEnabled(button->rapidfire);
+    spinDuty->setEnabled(button->rapidfire);
+    connect(chkRapid, SIGNAL(toggled(bool)), spinRate, SLOT(setEnabled(bool)));
+    connect(chkRapid, SIGNAL(toggled(bool)), spinDuty, SLOT(setEnabled(bool)));
+
+    h = new QHBoxLayout();
+    QLabel *holdLabel = new QLabel(tr("&Hold for"), this);
+    h->addWidget(holdLabel);
+    spinHold = new QSpinBox(this);
+    spinHold->setRange(0, MAXTAPTIME);
+    spinHold->setSingleStep(50);
+    spinHold->setSuffix(tr(" ms"));
+    spinHold->setSpecialValueText(tr("Off"));
+    spinHold->setToolTip(tr("Holding the button at least this long presses the key on the right instead."));
+    spinHold->setValue(button->holdTime);
+    h->addWidget(spinHold);
+    holdLabel->setBuddy(spinHold);
+    btnHoldKey = new KeyButton( tr("%1, held").arg(button->getName()), button->holdKeycode, this, true, button->holdUseMouse);
+    h->addWidget(btnHoldKey);
+    v->addLayout(h);
+
+    h = new QHBoxLayout();
+    QLabel *doubleLabel = new QLabel(tr("Double &tap within"), this);
+    h->addWidget(doubleLabel);
+    spinDouble = new QSpinBox(this);
+    spinDouble->setRange(0, MAXTAPTIME);
+    spinDouble->setSingleStep(50);
+    spinDouble->setSuffix(tr(" ms"));
+    spinDouble->setSpecialValueText(tr("Off"));
+    spinDouble->setToolTip(tr("Pressing the button again this soon after a tap presses the key on the right instead."));
+    spinDouble->setValue(button->doubleTime);
+    h->addWidget(spinDouble);
+    doubleLabel->setBuddy(spinDouble);
+    btnDoubleKey = new KeyButton( tr("%1, double tap").arg(button->getName()), button->doubleKeycode, this, true, button->doubleUseMouse);
+    h->addWidget(btnDoubleKey);
+    v->addLayout(h);
+
     QDialogButtonBox *buttonBox = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, Qt::Horizontal, this);
     connect(buttonBox, SIGNAL(accepted()), this, SLOT(accept()));
     connect(buttonBox, SIGNAL(rejected()), this, SLOT(reject()));
@@ -48,10 +107,22 @@ void ButtonEdit::accept() {
     	if (CRapid->isChecked()) takeTimer(button);
     }*/
     button->rapidfire = chkRapid->isChecked();
+    button->turboRate = spinRate->value();
+    button->turboDuty = spinDuty->value();
     button->sticky = chkSticky->isChecked();
+    //a different key doesn't keep the modifiers of the old one
+    if (btnKey->choseMouse() != button->useMouse || btnKey->getValue() != button->keycode) {
+        button->modifiers.clear();
+    }
     //if the user chose a mouse button...
     button->useMouse = btnKey->choseMouse();
     button->keycode = btnKey->getValue();
+    button->holdTime = spinHold->value();
+    button->holdUseMouse = btnHoldKey->choseMouse();
+    button->holdKeycode = btnHoldKey->getValue();
+    button->doubleTime = spinDouble->value();
+    button->doubleUseMouse = btnDoubleKey->choseMouse();
+    button->doubleKeycode = btnDoubleKey->getValue();
 
     QDialog::accept();
 }
@@ -3,6 +3,7 @@
 
 #include <QPushButton>
 #include <QCheckBox>
+#include <QSpinBox>
 #include <QDialogButtonBox>
 
 //we need to edit a Button
@@ -23,6 +24,9 @@ class ButtonEdit : public QDialog {
 		Button *button;
 		KeyButton *btnKey;
 		QCheckBox *chkSticky, *chkRapid;
+		QSpinBox *spinRate, *spinDuty;
+		QSpinBox *spinHold, *spinDouble;
+		KeyButton *btnHoldKey, *btnDoubleKey;
 };
 
 
@@ -0,0 +1,195 @@
+#include <QHeaderView>
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+
+#include <math.h>
+#include <algorithm>
+
+#include "calibration.h"
+
+//how long the idle noise is recorded
+#define CALIBRATION_MSEC 5000
+//how often the progress bar moves
+#define CALIBRATION_TICK_MSEC 100
+//how much room the proposed dead zone leaves beyond the noise
+#define CALIBRATION_MARGIN 500
+//dead zones and hysteresis are proposed in steps of this
+#define CALIBRATION_STEP 100
+
+enum Column {ColAxis, ColRest, ColPeak, ColStdDev, ColRate, ColFilteredNow,
+             ColDZone, ColXZone, ColHysteresis, ColFilteredThen, ColCount};
+
+static int roundUp( int value, int step ) {
+    return (value + step - 1) / step * step;
+}
+
+Calibration::Calibration( JoyPad* jp, QWidget *parent )
+        : QDialog(parent), joypad(jp), recording(false) {
+    setWindowTitle(tr("Calibrate %1").arg(jp->getName()));
+    QVBoxLayout* LMain = new QVBoxLayout(this);
+    LMain->setMargin(5);
+    LMain->setSpacing(5);
+
+    lblStatus = new QLabel(tr("Put the device down and don't touch it, then press Start.\n"
+                              "Its idle noise will be recorded for %1 seconds.").arg(CALIBRATION_MSEC / 1000), this);
+    LMain->addWidget(lblStatus);
+    progress = new QProgressBar(this);
+    progress->setRange(0, CALIBRATION_MSEC);
+    progress->setValue(0);
+    LMain->addWidget(progress);
+
+    table = new QTableWidget(joypad->axes.size(), ColCount, this);
+    table->setHorizontalHeaderLabels(QStringList()
+            << tr("Axis") << tr("Rest") << tr("Peak") << tr("Std. dev.")
+            << tr("Events/s") << tr("Filtered/s now")
+            << tr("Dead zone") << tr("Extreme zone") << tr("Hysteresis")
+            << tr("Filtered/s then"));
+    table->verticalHeader()->hide();
+    table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    table->setSelectionMode(QAbstractItemView::NoSelection);
+    for (int i = 0; i < joypad->axes.size(); ++ i) {
+        table->setItem(i, ColAxis, new QTableWidgetItem(joypad->axes[i]->getName()));
+    }
+    table->resizeColumnsToContents();
+    LMain->addWidget(table);
+
+    QHBoxLayout* h = new QHBoxLayout();
+    btnStart = new QPushButton(tr("&Start"), this);
+    connect(btnStart, SIGNAL(clicked()), this, SLOT(start()));
+    h->addWidget(btnStart);
+    btnApply = new QPushButton(tr("&Apply"), this);
+    btnApply->setEnabled(false);
+    connect(btnApply, SIGNAL(clicked()), this, SLOT(apply()));
+    h->addWidget(btnApply);
+    QPushButton* button = new QPushButton(tr("Close"), this);
+    connect(button, SIGNAL(clicked()), this, SLOT(reject()));
+    h->addWidget(button);
+    LMain->addLayout(h);
+
+    timer.setInterval(CALIBRATION_TICK_MSEC);
+    connect(&timer, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+Calibration::~Calibration() {
+    //closed while still recording
+    if (recording) joypad->setCalibrating(false);
+}
+
+void Calibration::start() {
+    samples.fill(QVector<int>(), joypad->axes.size());
+    proposals.clear();
+    btnStart->setEnabled(false);
+    btnApply->setEnabled(false);
+    lblStatus->setText(tr("Recording, don't touch the device..."));
+    //a dead zone joydev applies would hide the very noise we're after
+    joypad->setCalibrating(true);
+    recording = true;
+    progress->setValue(0);
+    elapsed.start();
+    timer.start();
+}
+
+void Calibration::tick() {
+    if (elapsed.elapsed() >= CALIBRATION_MSEC) {
+        finish();
+    }
+    else {
+        progress->setValue(elapsed.elapsed());
+    }
+}
+
+void Calibration::jsevent( const js_event& msg ) {
+    //the state that is reported again after dropped events isn't noise
+    if (!recording || (msg.type & JS_EVENT_INIT)) return;
+    if (msg.type == JS_EVENT_AXIS && msg.number < samples.size()) {
+        samples[msg.number].append(joypad->axes[msg.number]->throttled(msg.value));
+    }
+}
+
+void Calibration::finish() {
+    timer.stop();
+    recording = false;
+    joypad->setCalibrating(false);
+    const double seconds = elapsed.elapsed() / 1000.0;
+    progress->setValue(CALIBRATION_MSEC);
+
+    proposals.resize(samples.size());
+    for (int i = 0; i < samples.size(); ++ i) {
+        const Axis *axis = joypad->axes[i];
+        const QVector<int>& positions = samples[i];
+        Proposal& p = proposals[i];
+        p.dZone = axis->dZone;
+        p.xZone = axis->xZone;
+        p.hysteresis = axis->hysteresis;
+
+        if (positions.isEmpty()) {
+            //perfectly quiet, there's nothing to learn from this axis
+            table->setItem(i, ColRest, new QTableWidgetItem(tr("quiet")));
+            table->setItem(i, ColDZone, new QTableWidgetItem(QString::number(p.dZone)));
+            table->setItem(i, ColXZone, new QTableWidgetItem(QString::number(p.xZone)));
+            table->setItem(i, ColHysteresis, new QTableWidgetItem(QString::number(p.hysteresis)));
+            continue;
+        }
+
+        double sum = 0, sumSq = 0;
+        int peak = 0;
+        foreach (int position, positions) {
+            sum += position;
+            sumSq += (double) position * position;
+            peak = std::max(peak, abs(position));
+        }
+        const double mean = sum / positions.size();
+        const double stdDev = sqrt(std::max(sumSq / positions.size() - mean * mean, 0.0));
+
+        //wide enough for the worst we saw plus some more that we didn't,
+        //and the hysteresis about as wide as the jitter is from peak to peak
+        const int noise = peak + (int) ceil(3 * stdDev);
+        p.dZone = std::min(roundUp(noise + CALIBRATION_MARGIN, CALIBRATION_STEP), JOYMAX / 2);
+        p.hysteresis = std::min(roundUp((int) ceil(4 * stdDev), CALIBRATION_STEP), p.dZone / 2);
+        //noise doesn't say anything about the extreme zone, only keep a
+        //usable range between the two
+        p.xZone = std::min(std::max(axis->xZone, p.dZone + JOYMAX / 4), JOYMAX);
+
+        const int filteredNow = filtered(positions, axis->dZone, axis->hysteresis);
+        const int filteredThen = filtered(positions, p.dZone, p.hysteresis);
+        table->setItem(i, ColRest, new QTableWidgetItem(QString::number(mean, 'f', 0)));
+        table->setItem(i, ColPeak, new QTableWidgetItem(QString::number(peak)));
+        table->setItem(i, ColStdDev, new QTableWidgetItem(QString::number(stdDev, 'f', 1)));
+        table->setItem(i, ColRate, new QTableWidgetItem(QString::number(positions.size() / seconds, 'f', 1)));
+        table->setItem(i, ColFilteredNow, new QTableWidgetItem(QString::number(filteredNow / seconds, 'f', 1)));
+        table->setItem(i, ColDZone, new QTableWidgetItem(QString::number(p.dZone)));
+        table->setItem(i, ColXZone, new QTableWidgetItem(QString::number(p.xZone)));
+        table->setItem(i, ColHysteresis, new QTableWidgetItem(QString::number(p.hysteresis)));
+        table->setItem(i, ColFilteredThen, new QTableWidgetItem(QString::number(filteredThen / seconds, 'f', 1)));
+    }
+    table->resizeColumnsToContents();
+
+    lblStatus->setText(tr("Done. Apply the proposed values or start over."));
+    btnStart->setEnabled(true);
+    btnApply->setEnabled(!proposals.isEmpty());
+}
+
+int Calibration::filtered( const QVector<int>& positions, int dZone, int hysteresis ) {
+    //the same decisions as Axis::process, without doing anything
+    const int offZone = std::max(dZone - hysteresis, 0);
+    bool isOn = false;
+    int count = 0;
+    foreach (int position, positions) {
+        if (isOn && abs(position) <= offZone) isOn = false;
+        else if (!isOn && abs(position) >= dZone) isOn = true;
+        else ++ count;
+    }
+    return count;
+}
+
+void Calibration::apply() {
+    for (int i = 0; i < proposals.size() && i < joypad->axes.size(); ++ i) {
+        Axis *axis = joypad->axes[i];
+        axis->dZone = proposals[i].dZone;
+        axis->xZone = proposals[i].xZone;
+        axis->hysteresis = proposals[i].hysteresis;
+        axis->adjustGradient();
+        emit axis->changed();
+    }
+    accept();
+}
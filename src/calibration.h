@@ -0,0 +1,62 @@
+#ifndef QJOYPAD_CALIBRATION_H
+#define QJOYPAD_CALIBRATION_H
+
+//for building the dialog
+#include <QDialog>
+#include <QLabel>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QTableWidget>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include <linux/joystick.h>
+
+//to measure and set the joypad
+#include "joypad.h"
+
+class JoyPad;
+
+//a dialog that listens to the joypad while nobody touches it and proposes
+//dead zones (and hysteresis) just wide enough to swallow the idle noise of
+//every axis.
+class Calibration : public QDialog {
+    Q_OBJECT
+
+	public:
+        Calibration(JoyPad* jp, QWidget *parent = 0);
+        ~Calibration();
+		//this needs to see js_events so it can record them directly
+        void jsevent( const js_event& msg );
+	private slots:
+        void start();
+        void tick();
+        void apply();
+	private:
+        //what we'd set an axis to
+        struct Proposal {
+            int dZone;
+            int xZone;
+            int hysteresis;
+        };
+        void finish();
+        //how many of the recorded positions the given dead zone and
+        //hysteresis would have dropped before they caused any output
+        static int filtered( const QVector<int>& positions, int dZone, int hysteresis );
+
+		//the joypad that is being calibrated
+		JoyPad* joypad;
+        QLabel *lblStatus;
+        QProgressBar *progress;
+        QTableWidget *table;
+        QPushButton *btnStart, *btnApply;
+        QTimer timer;
+        QElapsedTimer elapsed;
+        bool recording;
+        //every position each axis reported while recording, in order
+        QVector<QVector<int> > samples;
+        QVector<Proposal> proposals;
+};
+
+#endif
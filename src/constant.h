@@ -16,12 +16,25 @@
 #define JOYMAX 32767
 #define JOYMIN -32767
 
-//maximum number of defined keys
-#define MAXKEY 122
+//highest X keycode (and mouse button). Keys are kept as keysyms (see
+//keymap.h), keycodes only come up in old layouts.
+#define MAXKEY 255
 
 //fastest the mouse can go. Completely arbitrary.
 #define MAXMOUSESPEED 5000
 
+//how long udev events are collected before the device list is updated, so a
+//burst of events (e.g. a USB hub coming up) causes only one update.
+#define UDEV_BATCH_MSEC 25
+
+//when a device fails, it is reopened after RECONNECT_MIN_MSEC, and then again
+//with the delay doubling up to RECONNECT_MAX_MSEC, RECONNECT_ATTEMPTS times in
+//all; after that, its slot is free for other devices. With udev, its "add"
+//event usually brings the device back sooner.
+#define RECONNECT_MIN_MSEC 20
+#define RECONNECT_MAX_MSEC 2000
+#define RECONNECT_ATTEMPTS 30
+
 #define SENSITIVITY_MIN	1e-8F
 #define SENSITIVITY_MAX	1e+8F
 
@@ -0,0 +1,72 @@
+#include <QFile>
+#include <QFileInfo>
+
+#include "deviceinfo.h"
+
+#include <linux/joystick.h>
+#include <sys/ioctl.h>
+#include <string.h>
+
+//read an attribute of the input device that owns the given jsN node
+static QString readSysAttr(const QString& node, const char *attr) {
+    QFile file(QString("/sys/class/input/%1/device/%2").arg(node, attr));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    return QString::fromLocal8Bit(file.readAll()).trimmed();
+}
+
+DeviceInfo::DeviceInfo()
+    : vendor(0), product(0), axisCount(0), buttonCount(0) {}
+
+DeviceInfo DeviceInfo::probe(int fd, const QString &devpath) {
+    DeviceInfo info = peek(devpath);
+
+    char id[256];
+    memset(id, 0, sizeof(id));
+    if (ioctl(fd, JSIOCGNAME(sizeof(id)), id) < 0) {
+        info.name = "Unknown";
+    }
+    else {
+        info.name = id;
+    }
+
+    //read in the number of axes / buttons
+    unsigned char count = 0;
+    ioctl(fd, JSIOCGAXES, &count);
+    info.axisCount = count;
+    count = 0;
+    ioctl(fd, JSIOCGBUTTONS, &count);
+    info.buttonCount = count;
+
+    return info;
+}
+
+DeviceInfo DeviceInfo::peek(const QString &devpath) {
+    DeviceInfo info;
+    info.path = devpath;
+
+    //these are missing for some virtual devices, in which case the name
+    //alone has to do.
+    const QString node = QFileInfo(devpath).fileName();
+    info.name = readSysAttr(node, "name");
+    bool ok = false;
+    info.vendor = readSysAttr(node, "id/vendor").toUShort(&ok, 16);
+    if (!ok) info.vendor = 0;
+    info.product = readSysAttr(node, "id/product").toUShort(&ok, 16);
+    if (!ok) info.product = 0;
+    info.uniq = readSysAttr(node, "uniq");
+
+    return info;
+}
+
+QString DeviceInfo::identity() const {
+    QString ident = QString("%1:%2 %3")
+            .arg(vendor, 4, 16, QChar('0'))
+            .arg(product, 4, 16, QChar('0'))
+            .arg(name);
+    if (!uniq.isEmpty()) {
+        ident += QString(" (%1)").arg(uniq);
+    }
+    return ident;
+}
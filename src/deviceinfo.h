@@ -0,0 +1,36 @@
+#ifndef QJOYPAD_DEVICEINFO_H
+#define QJOYPAD_DEVICEINFO_H
+
+#include <QMetaType>
+#include <QString>
+
+//everything we learn about a joystick device when we open it: where it is,
+//what it is and what it has. Unlike the jsN index, the identity stays the
+//same when a device gets replugged or the devices come up in another order.
+struct DeviceInfo {
+    DeviceInfo();
+
+    //ask an open device for its name and dimensions and look up vendor,
+    //product and uniq in sysfs (these are the same attributes udev reports).
+    static DeviceInfo probe(int fd, const QString& devpath);
+    //only look up name, vendor, product and uniq in sysfs, without opening
+    //the device. Good enough to tell if a device node changed hands.
+    static DeviceInfo peek(const QString& devpath);
+
+    //a string identifying this kind of device, or this very device if it
+    //reports a serial/MAC address. Layouts are bound to devices by it.
+    QString identity() const;
+
+    QString path;
+    QString name;
+    QString uniq;
+    unsigned short vendor;
+    unsigned short product;
+    int axisCount;
+    int buttonCount;
+};
+
+//so probe results can be passed between threads
+Q_DECLARE_METATYPE(DeviceInfo)
+
+#endif
@@ -0,0 +1,49 @@
+#include <QElapsedTimer>
+#include <QRunnable>
+
+#include "deviceprober.h"
+
+#include <fcntl.h>
+#include <errno.h>
+
+//how many devices are probed at once
+#define PROBE_THREADS 4
+
+class ProbeTask : public QRunnable {
+	public:
+		ProbeTask( DeviceProber *prober, int index, unsigned serial, const QString& devpath )
+			: prober(prober), index(index), serial(serial), devpath(devpath) {}
+		void run();
+	private:
+		DeviceProber *prober;
+		int index;
+		unsigned serial;
+		QString devpath;
+};
+
+void ProbeTask::run() {
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    int joydev = ::open(qPrintable(devpath), O_RDONLY | O_NONBLOCK);
+    if (joydev < 0) {
+        emit prober->failed(index, serial, devpath, errno);
+        return;
+    }
+    DeviceInfo info = DeviceInfo::probe(joydev, devpath);
+    emit prober->probed(index, serial, joydev, info, elapsed.nsecsElapsed() / 1000);
+}
+
+DeviceProber::DeviceProber( QObject *parent ) : QObject(parent) {
+    qRegisterMetaType<DeviceInfo>("DeviceInfo");
+    pool.setMaxThreadCount(PROBE_THREADS);
+}
+
+DeviceProber::~DeviceProber() {
+    pool.waitForDone();
+}
+
+void DeviceProber::probe( int index, unsigned serial, const QString& devpath ) {
+    //the pool deletes the task once it has run
+    pool.start(new ProbeTask(this, index, serial, devpath));
+}
@@ -0,0 +1,31 @@
+#ifndef QJOYPAD_DEVICEPROBER_H
+#define QJOYPAD_DEVICEPROBER_H
+
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+
+#include "deviceinfo.h"
+
+//opens and probes joystick devices on a small pool of worker threads, so a
+//slow device (some USB and Bluetooth adapters take their time answering
+//ioctls) neither blocks the GUI nor the other devices. The results are
+//delivered by queued signals and merged on the GUI thread.
+class DeviceProber : public QObject {
+	Q_OBJECT
+	public:
+		DeviceProber( QObject *parent = 0 );
+		//waits for all probes still running
+		~DeviceProber();
+		//open and probe devpath in the background. index and serial are
+		//passed back untouched so the caller can tell stale results apart.
+		void probe( int index, unsigned serial, const QString& devpath );
+	signals:
+		//joydev is an open file descriptor, the receiver takes ownership.
+		void probed( int index, unsigned serial, int joydev, const DeviceInfo& info, long long usec );
+		void failed( int index, unsigned serial, const QString& devpath, int error );
+	private:
+		QThreadPool pool;
+};
+
+#endif
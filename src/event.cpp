@@ -1,35 +1,630 @@
 #include <QX11Info>
+#include <QSocketNotifier>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <stdio.h>
+#include <stdlib.h>
 #include "event.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "error.h"
+#include "config.h"
+#include "constant.h"
+#include "keymap.h"
 
-//actually creates an XWindows event  :)
-void sendevent(const FakeEvent &e) {
-    Display* display = QX11Info::display();
+#ifdef WITH_XCB
+#include <xcb/xcb.h>
+#include <xcb/xtest.h>
+#endif
 
+//how many server timed sequences are followed up to see when the server
+//really was done with them (1 in SERVERTIMING_SAMPLE), as that takes a round
+//trip and a wakeup of its own
+#define SERVERTIMING_SAMPLE 16
+
+//the longest flush window that can be set (msec)
+#define MAXFLUSHWINDOW 100
+
+//how many requests the benchmark puts on Qt's connection before every event,
+//about what repainting the setup dialog takes
+#define BENCHMARK_GUI_REQUESTS 2000
+
+static Stat serverSequences("Server timed sequences");
+static Stat serverBusy("Server timed sequences overlapping (timed locally)");
+static Stat serverLag("Server timed sequence lateness", " us");
+static Stat flushes("X flushes");
+static Stat eventsPerFlush("Events per X flush");
+static Stat writesPerSecond("X flushes per second");
+static Stat queueLatency("Output queue latency", " us");
+static Stat flushTime("X flush time", " us");
+static Stat outputErrors("X errors on the output connections");
+static Stat redundantEvents("Presses / releases of keys held by another component");
+
+//the connection events are sent on, so they never queue up behind what
+//Qt sends to draw the GUI. 0 if it couldn't be opened, Qt's is used then.
+static Display *injection = 0;
+static QSocketNotifier *injectionNotifier = 0;
+static XErrorHandler otherErrorHandler = 0;
+
+static int flushWindow = 0;
+//events that were queued but not flushed yet
+static int pending = 0;
+//when the first of them was queued
+static qint64 firstPending = 0;
+//for counting the flushes of every second
+static qint64 secondStart = 0;
+static int secondFlushes = 0;
+
+static bool useServerTiming = false;
+//sequences are sent on a connection of their own: the server doesn't
+//process anything else a client sends while it waits out a delay, and
+//Qt's connection must never stall like that
+static Display *timingDisplay = 0;
+static qint64 serverBusyUntil = 0;
+static int sequenceCount = 0;
+//events were flushed on the output connection since the last sequence.
+//The server doesn't keep the order of requests on different connections,
+//so the sequence has to wait until they were processed.
+static bool outputUnsynced = false;
+
+//how many components hold down each key / mouse button, by what is sent for
+//it: the keycode, or the keysym itself without an X server. Only the first
+//press and the last release of one are sent, so a component letting go
+//doesn't release what another still holds. Keys nobody holds aren't in here.
+static QHash<int, int> keysDown;
+static QHash<int, int> buttonsDown;
+//the keycodes every keysym is held as, one for every press, so it is
+//released as one of them even if the keyboard mapping changed in between
+static QHash<int, QVector<int> > pressedAs;
+
+//finds out when the server got to the end of a sequence, which is as
+//late as the first request after it gets answered
+class ServerTimingCheck : public Timed {
+    public:
+        void timeout( qint64 due ) {
+            if (!timingDisplay) return;
+            XSync(timingDisplay, False);
+            //like the Scheduler's own lateness, against the same clock
+            serverLag.add(Scheduler::now() - due);
+        }
+};
+static ServerTimingCheck serverTimingCheck;
+
+//the presses of a sequence count as held (see keysDown) until the server is
+//done with it. A component that pressed one of them meanwhile had its key
+//let go of by the sequence's release; it is pressed again then.
+class SequenceEnd : public Timed {
+    public:
+        void timeout( qint64 );
+        QVector<FakeEvent> presses;
+    private:
+        QSet<QPair<int, int> > repressed;
+};
+static SequenceEnd sequenceEnd;
+
+#ifdef WITH_XCB
+//with the XCB backend, events go out on a connection of their own, as
+//requests that never wait for a reply and without Xlib's locking
+static xcb_connection_t *xcbConnection = 0;
+//reads the errors of those requests, the only thing that comes back
+static QSocketNotifier *xcbNotifier = 0;
+
+static void xcbfakeevent(const FakeEvent &e, unsigned long delay) {
+    switch (e.type) {
+    case FakeEvent::MouseMove:
+        //detail 1 makes the motion relative
+        xcb_test_fake_input(xcbConnection, XCB_MOTION_NOTIFY, 1, delay, XCB_NONE, e.move.x, e.move.y, 0);
+        break;
+
+    case FakeEvent::KeyUp:
+        xcb_test_fake_input(xcbConnection, XCB_KEY_RELEASE, e.keycode, delay, XCB_NONE, 0, 0, 0);
+        break;
+
+    case FakeEvent::KeyDown:
+        xcb_test_fake_input(xcbConnection, XCB_KEY_PRESS, e.keycode, delay, XCB_NONE, 0, 0, 0);
+        break;
+
+    case FakeEvent::MouseUp:
+        xcb_test_fake_input(xcbConnection, XCB_BUTTON_RELEASE, e.keycode, delay, XCB_NONE, 0, 0, 0);
+        break;
+
+    case FakeEvent::MouseDown:
+        xcb_test_fake_input(xcbConnection, XCB_BUTTON_PRESS, e.keycode, delay, XCB_NONE, 0, 0, 0);
+        break;
+    }
+}
+#endif
+
+//flushes the queue once the flush window of its first event is over, or
+//right after the current batch for events that came from outside of one
+class FlushDeadline : public Timed {
+    public:
+        void timeout( qint64 ) {
+            flushevents();
+        }
+};
+static FlushDeadline flushDeadline;
+
+//every flush is a write to the X server
+static void countFlush() {
+    flushes.count();
+    const qint64 now = Scheduler::now();
+    if (now - secondStart >= 1000000) {
+        //only the seconds in which we flushed at all are counted
+        if (secondFlushes > 0) writesPerSecond.add(secondFlushes);
+        secondStart = now;
+        secondFlushes = 0;
+    }
+    ++ secondFlushes;
+}
+
+static Display *outputDisplay() {
+    return injection ? injection : QX11Info::display();
+}
+
+//the error handler is the same for all Xlib connections; errors of ours
+//only get counted, everything else goes where it went before
+static int outputError(Display *display, XErrorEvent *error) {
+    if (display == injection || display == timingDisplay) {
+        outputErrors.count();
+        debug_mesg("X error %d (request %d) on an output connection\n", error->error_code, error->request_code);
+        return 0;
+    }
+    return otherErrorHandler ? otherErrorHandler(display, error) : 0;
+}
+
+#ifdef WITH_XCB
+static void closeXcb() {
+    delete xcbNotifier;
+    xcbNotifier = 0;
+    if (xcbConnection) {
+        xcb_disconnect(xcbConnection);
+        xcbConnection = 0;
+    }
+}
+#endif
+
+bool openOutput() {
+    if (injection) return true;
+    if (!QX11Info::isPlatformX11()) return false;
+    injection = XOpenDisplay(DisplayString(QX11Info::display()));
+    if (!injection) {
+        debug_mesg("couldn't open an X connection for the output, sharing Qt's\n");
+        return false;
+    }
+    XErrorHandler previous = XSetErrorHandler(outputError);
+    if (previous != outputError) otherErrorHandler = previous;
+    //nothing but errors ever comes back on this connection (we don't ask
+    //for events or replies), read them so they don't pile up
+    injectionNotifier = new QSocketNotifier(ConnectionNumber(injection), QSocketNotifier::Read);
+    QObject::connect(injectionNotifier, &QSocketNotifier::activated, [](int) {
+        if (injection) XPending(injection);
+    });
+    return true;
+}
+
+void closeOutput() {
+    flushevents();
+    restorekeymap();
+    delete injectionNotifier;
+    injectionNotifier = 0;
+    if (injection) {
+        XCloseDisplay(injection);
+        injection = 0;
+    }
+    if (timingDisplay) {
+        XCloseDisplay(timingDisplay);
+        timingDisplay = 0;
+    }
+#ifdef WITH_XCB
+    closeXcb();
+#endif
+}
+
+static void fakeevent(Display* display, const FakeEvent &e, unsigned long delay) {
     switch (e.type) {
     case FakeEvent::MouseMove:
-        if (e.move.x == 0 && e.move.y == 0) return;
-        XTestFakeRelativeMotionEvent(display, e.move.x, e.move.y, 0);
+        XTestFakeRelativeMotionEvent(display, e.move.x, e.move.y, delay);
         break;
 
     case FakeEvent::KeyUp:
-        if (e.keycode == 0) return;
-        XTestFakeKeyEvent(display, e.keycode, false, 0);
+        XTestFakeKeyEvent(display, e.keycode, false, delay);
         break;
 
     case FakeEvent::KeyDown:
-        if (e.keycode == 0) return;
-        XTestFakeKeyEvent(display, e.keycode, true, 0);
+        XTestFakeKeyEvent(display, e.keycode, true, delay);
         break;
 
     case FakeEvent::MouseUp:
-        if (e.keycode == 0) return;
-        XTestFakeButtonEvent(display, e.keycode, false, 0);
+        XTestFakeButtonEvent(display, e.keycode, false, delay);
         break;
 
     case FakeEvent::MouseDown:
-        if (e.keycode == 0) return;
-        XTestFakeButtonEvent(display, e.keycode, true, 0);
+        XTestFakeButtonEvent(display, e.keycode, true, delay);
         break;
     }
-    XFlush(display);
+}
+
+//true iff the event would do nothing at all
+static bool isNoop(const FakeEvent &e) {
+    if (e.type == FakeEvent::MouseMove) return e.move.x == 0 && e.move.y == 0;
+    return e.keycode == 0;
+}
+
+//the event with the keycode of its keysym, as the X server wants it
+static FakeEvent resolve(const FakeEvent &e) {
+    FakeEvent resolved = e;
+    if (e.type == FakeEvent::KeyDown) {
+        resolved.keycode = keysymtokeycode(e.keycode);
+        pressedAs[e.keycode].append(resolved.keycode);
+    }
+    else if (e.type == FakeEvent::KeyUp) {
+        QHash<int, QVector<int> >::iterator it = pressedAs.find(e.keycode);
+        if (it == pressedAs.end()) {
+            resolved.keycode = keysymtokeycode(e.keycode);
+        }
+        else {
+            //which press of the keysym this release belongs to doesn't
+            //matter, as long as every keycode gets as many releases as it
+            //got presses
+            resolved.keycode = it.value().takeLast();
+            if (it.value().isEmpty()) pressedAs.erase(it);
+        }
+    }
+    return resolved;
+}
+
+//the counts of the keys or the mouse buttons, whichever e is for
+static QHash<int, int> &downCounts(const FakeEvent &e) {
+    const bool mouse = e.type == FakeEvent::MouseDown || e.type == FakeEvent::MouseUp;
+    return mouse ? buttonsDown : keysDown;
+}
+
+//takes back one press, true iff that was the last one
+static bool letGo(const FakeEvent &e) {
+    QHash<int, int> &counts = downCounts(e);
+    QHash<int, int>::iterator it = counts.find(e.keycode);
+    if (it == counts.end() || -- it.value() > 0) return false;
+    counts.erase(it);
+    return true;
+}
+
+//counts a press or release, true iff it has to be sent
+static bool countDown(const FakeEvent &e) {
+    if (e.type == FakeEvent::MouseMove) return true;
+    if (e.type == FakeEvent::KeyDown || e.type == FakeEvent::MouseDown) {
+        if (downCounts(e)[e.keycode] ++ == 0) return true;
+    }
+    //a release of what nobody pressed is dropped as well
+    else if (letGo(e)) {
+        return true;
+    }
+    redundantEvents.count();
+    return false;
+}
+
+//true iff a component holds down what e presses or releases
+static bool isHeld(const FakeEvent &e) {
+    if (e.type == FakeEvent::MouseMove) return false;
+    return downCounts(e).contains(e.keycode);
+}
+
+//the default sink, which actually creates XWindows events  :)
+class XTestSink : public OutputSink {
+    public:
+        void send(const FakeEvent &e) {
+#ifdef WITH_XCB
+            if (xcbConnection) xcbfakeevent(e, 0);
+            else
+#endif
+            fakeevent(outputDisplay(), e, 0);
+        }
+        void flush() {
+#ifdef WITH_XCB
+            if (xcbConnection) xcb_flush(xcbConnection);
+            else
+#endif
+            XFlush(outputDisplay());
+            outputUnsynced = true;
+        }
+        bool sendSequence(const FakeEvent *events, const int *delays, int count);
+};
+static XTestSink xtestSink;
+static OutputSink *sink = &xtestSink;
+
+void setOutputSink(OutputSink *s) {
+    flushevents();
+    sink = s ? s : &xtestSink;
+}
+
+OutputSink *xtestOutput() {
+    return &xtestSink;
+}
+
+//hand an event that was counted already to the sink
+static void queueevent(const FakeEvent &e) {
+    sink->send(e);
+    if (pending ++ == 0) {
+        firstPending = Scheduler::now();
+        Scheduler::instance()->schedule(&flushDeadline, firstPending + (qint64) flushWindow * 1000);
+    }
+}
+
+void sendevent(const FakeEvent &event) {
+    if (isNoop(event)) return;
+    const FakeEvent e = resolve(event);
+    if (isNoop(e) || !countDown(e)) return;
+    queueevent(e);
+}
+
+void SequenceEnd::timeout( qint64 ) {
+    Scheduler::instance()->cancel(this);
+    foreach (const FakeEvent &press, presses) {
+        letGo(press);
+    }
+    //what's still held now is held by a component
+    foreach (const FakeEvent &press, presses) {
+        const QPair<int, int> key(press.type, press.keycode);
+        if (isHeld(press) && !repressed.contains(key)) {
+            repressed.insert(key);
+            queueevent(press);
+        }
+    }
+    repressed.clear();
+    presses.clear();
+}
+
+void sendchord(const FakeEvent &e, const QVector<int> &modifiers) {
+    const bool press = e.type == FakeEvent::KeyDown || e.type == FakeEvent::MouseDown;
+    FakeEvent modifier;
+    modifier.type = press ? FakeEvent::KeyDown : FakeEvent::KeyUp;
+    if (press) {
+        foreach (int code, modifiers) {
+            modifier.keycode = code;
+            sendevent(modifier);
+        }
+        sendevent(e);
+    }
+    else {
+        sendevent(e);
+        for (int i = modifiers.size() - 1; i >= 0; -- i) {
+            modifier.keycode = modifiers[i];
+            sendevent(modifier);
+        }
+    }
+}
+
+bool readchord(const QString &word, bool mouse, QVector<int> &modifiers, int &code) {
+    const QStringList codes = word.split('+');
+    if (codes.size() > MAXMODIFIERS + 1) return false;
+    QVector<int> values;
+    bool ok;
+    for (int i = 0; i < codes.size(); ++ i) {
+        int val;
+        if (mouse && i == codes.size() - 1) {
+            val = codes[i].toInt(&ok);
+            if (!ok || val < 0 || val > MAXKEY) return false;
+        }
+        else if (!readkey(codes[i], val)) {
+            return false;
+        }
+        values.append(val);
+    }
+    //everything but the last one is a modifier
+    code = values.last();
+    values.pop_back();
+    modifiers = values;
+    return true;
+}
+
+QString writechord(const QVector<int> &modifiers, bool mouse, int code) {
+    QString chord;
+    foreach (int mod, modifiers) chord += writekey(mod) + "+";
+    return chord + (mouse ? QString::number(code) : writekey(code));
+}
+
+bool setOutputBackend(OutputBackend backend) {
+#ifdef WITH_XCB
+    flushevents();
+    closeXcb();
+    if (backend == XcbBackend) {
+        if (!QX11Info::isPlatformX11()) return false;
+        xcbConnection = xcb_connect(DisplayString(QX11Info::display()), NULL);
+        if (xcb_connection_has_error(xcbConnection)) {
+            closeXcb();
+            return false;
+        }
+        //without XTest every event would fail, and only as an error
+        const xcb_query_extension_reply_t *xtest = xcb_get_extension_data(xcbConnection, &xcb_test_id);
+        if (!xtest || !xtest->present) {
+            debug_mesg("the X server has no XTest extension for the XCB connection\n");
+            closeXcb();
+            return false;
+        }
+        //like the Xlib output connection, only errors come back: count them
+        //and don't let them pile up
+        xcbNotifier = new QSocketNotifier(xcb_get_file_descriptor(xcbConnection), QSocketNotifier::Read);
+        QObject::connect(xcbNotifier, &QSocketNotifier::activated, [](int) {
+            if (!xcbConnection) return;
+            xcb_generic_event_t *event;
+            while ((event = xcb_poll_for_event(xcbConnection)) != NULL) {
+                if (event->response_type == 0) {
+                    const xcb_generic_error_t *error = (const xcb_generic_error_t *) event;
+                    outputErrors.count();
+                    debug_mesg("X error %d (request %d) on an output connection\n", error->error_code, error->major_code);
+                }
+                free(event);
+            }
+        });
+    }
+    return true;
+#else
+    return backend == XlibBackend;
+#endif
+}
+
+void setFlushWindow(int msec) {
+    flushWindow = qBound(0, msec, MAXFLUSHWINDOW);
+}
+
+void endbatch() {
+    if (flushWindow == 0) flushevents();
+}
+
+void flushevents() {
+    if (pending == 0) return;
+    Scheduler::instance()->cancel(&flushDeadline);
+    const qint64 start = Scheduler::now();
+    sink->flush();
+    const qint64 end = Scheduler::now();
+    //how long the events waited to be sent, and how long sending took
+    queueLatency.add(end - firstPending);
+    flushTime.add(end - start);
+    eventsPerFlush.add(pending);
+    pending = 0;
+    countFlush();
+}
+
+void setServerTiming(bool on) {
+    useServerTiming = on;
+}
+
+bool serverTiming() {
+    return useServerTiming;
+}
+
+bool sendsequence(const FakeEvent *events, const int *delays, int count) {
+    if (!useServerTiming) return false;
+    //a sequence releases only what it pressed itself, and the mapping
+    //can't change in the middle of it
+    QVector<FakeEvent> resolved(count);
+    for (int i = 0; i < count; ++ i) {
+        resolved[i] = events[i];
+        if (events[i].type == FakeEvent::KeyDown || events[i].type == FakeEvent::KeyUp) {
+            resolved[i].keycode = keysymtokeycode(events[i].keycode);
+        }
+    }
+    return sink->sendSequence(resolved.constData(), delays, count);
+}
+
+bool XTestSink::sendSequence(const FakeEvent *events, const int *delays, int count) {
+    const qint64 now = Scheduler::now();
+    if (serverBusyUntil > now) {
+        serverBusy.count();
+        return false;
+    }
+    if (!timingDisplay) {
+        if (QX11Info::isPlatformX11()) timingDisplay = XOpenDisplay(DisplayString(QX11Info::display()));
+        if (!timingDisplay) {
+            debug_mesg("couldn't open a second X connection, timing events locally\n");
+            useServerTiming = false;
+            return false;
+        }
+    }
+
+    //the last sequence is over, even if its deadline didn't come yet
+    if (!sequenceEnd.presses.isEmpty()) sequenceEnd.timeout(now);
+
+    //a key that is held down already stays down, the sequence would only
+    //let go of it. That is up to what's held before the sequence.
+    QVector<bool> skip(count);
+    for (int i = 0; i < count; ++ i) skip[i] = isNoop(events[i]) || isHeld(events[i]);
+
+    //what's queued for now must not come after the sequence, not even on
+    //the server's side
+    flushevents();
+    if (outputUnsynced) {
+#ifdef WITH_XCB
+        if (xcbConnection) free(xcb_get_input_focus_reply(xcbConnection, xcb_get_input_focus(xcbConnection), NULL));
+        else
+#endif
+        XSync(outputDisplay(), False);
+        outputUnsynced = false;
+    }
+    qint64 total = 0;
+    //a delay of an event that isn't sent still counts for the next one
+    int delay = 0;
+    for (int i = 0; i < count; ++ i) {
+        delay += delays[i];
+        if (skip[i]) continue;
+        const FakeEvent &e = events[i];
+        fakeevent(timingDisplay, e, delay);
+        total += delay;
+        delay = 0;
+        //presses count as held until the sequence is over, releases only
+        //count then
+        if (e.type == FakeEvent::KeyDown || e.type == FakeEvent::MouseDown) {
+            ++ downCounts(e)[e.keycode];
+            sequenceEnd.presses.append(e);
+        }
+    }
+    XFlush(timingDisplay);
+    countFlush();
+    serverSequences.count();
+    serverBusyUntil = now + total * 1000;
+    if (!sequenceEnd.presses.isEmpty()) {
+        Scheduler::instance()->schedule(&sequenceEnd, serverBusyUntil);
+    }
+    if (++ sequenceCount % SERVERTIMING_SAMPLE == 0) {
+        Scheduler::instance()->schedule(&serverTimingCheck, serverBusyUntil);
+    }
+    return true;
+}
+
+bool sendpulse(bool mouse, int code, qint64 down, const QVector<int> &modifiers) {
+    const int count = modifiers.size();
+    if (count > MAXMODIFIERS) return false;
+    //the modifiers, the key, (down later) its release and the modifiers'
+    FakeEvent pulse[2 * MAXMODIFIERS + 2];
+    int delays[2 * MAXMODIFIERS + 2] = {0};
+    for (int i = 0; i < count; ++ i) {
+        pulse[i].type = FakeEvent::KeyDown;
+        pulse[i].keycode = modifiers[i];
+        pulse[2 * count + 1 - i].type = FakeEvent::KeyUp;
+        pulse[2 * count + 1 - i].keycode = modifiers[i];
+    }
+    pulse[count].type = mouse ? FakeEvent::MouseDown : FakeEvent::KeyDown;
+    pulse[count].keycode = code;
+    pulse[count + 1].type = mouse ? FakeEvent::MouseUp : FakeEvent::KeyUp;
+    pulse[count + 1].keycode = code;
+    //XTest delays are whole milliseconds
+    delays[count + 1] = (int) qMax((down + 500) / 1000, (qint64) 1);
+    return sendsequence(pulse, delays, 2 * count + 2);
+}
+
+void benchmarkoutput(int count) {
+    if (!QX11Info::isPlatformX11()) return;
+    Display *gui = QX11Info::display();
+    //sharing Qt's connection first, then with one of our own
+    Display *displays[2] = {gui, injection};
+    const char *names[2] = {"shared", "dedicated"};
+    printf("%-10s %-6s %10s %10s %10s\n", "connection", "GUI", "min (us)", "avg (us)", "max (us)");
+    for (int d = 0; d < 2; ++ d) {
+        if (!displays[d]) continue;
+        for (int busy = 0; busy < 2; ++ busy) {
+            qint64 min = -1, max = 0, sum = 0;
+            for (int i = 0; i < count; ++ i) {
+                //stand-ins for the requests of a repaint, waiting on Qt's
+                //connection when the event is sent
+                if (busy) {
+                    for (int j = 0; j < BENCHMARK_GUI_REQUESTS; ++ j) XNoOp(gui);
+                    XFlush(gui);
+                }
+                //a motion by one pixel, and back the next time: from
+                //sending it until the server has processed it
+                const qint64 start = Scheduler::now();
+                XTestFakeRelativeMotionEvent(displays[d], (i % 2) ? -1 : 1, 0, 0);
+                XSync(displays[d], False);
+                const qint64 time = Scheduler::now() - start;
+                if (min < 0 || time < min) min = time;
+                if (time > max) max = time;
+                sum += time;
+                if (busy) XSync(gui, False);
+            }
+            printf("%-10s %-6s %10lld %10lld %10lld\n", names[d], busy ? "busy" : "idle",
+                   (long long) min, (long long) (count > 0 ? sum / count : 0), (long long) max);
+        }
+    }
 }
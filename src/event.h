@@ -4,6 +4,12 @@
 //for the functions we need to generate keypresses / mouse actions
 #include <X11/extensions/XTest.h>
 
+#include <QString>
+#include <QVector>
+
+//a key or mouse button can have up to this many modifier keys with it
+#define MAXMODIFIERS 4
+
 //a simplified event structure that can handle buttons and mouse movements
 struct FakeEvent {
     //types of events QJoyPad can create.
@@ -12,6 +18,8 @@ struct FakeEvent {
 
     EventType type;
     union {
+        //the mouse button, or the keysym of the key (see keymap.h). It is
+        //only turned into a keycode when sent.
         int keycode;
 
         struct {
@@ -21,6 +29,74 @@ struct FakeEvent {
     };
 };
 
+//events are sent on an X connection of their own, opened here and closed
+//with closeOutput(). Returns false if it can't be opened; Qt's connection is
+//used then.
+bool openOutput();
+void closeOutput();
+//send count mouse motions (by one pixel and back) and print how long it
+//takes the server to process each, through Qt's connection and through our
+//own one, with Qt's connection idle and busy
+void benchmarkoutput(int count);
+
+//where events are sent: through Xlib (see openOutput()), or through an XCB
+//connection (only if built WITH_XCB)
+enum OutputBackend {XlibBackend, XcbBackend};
+//returns false if the backend isn't available; Xlib is used then
+bool setOutputBackend(OutputBackend backend);
+
+//queue an event. Events are sent to the X server together, with one flush,
+//at the end of the batch of joystick events or deadlines that made them
+//(endbatch()) or, with a flush window, at most that long after the first.
 void sendevent(const FakeEvent& e);
+//send a press or release of a chord like Ctrl+Shift+T: the modifier keys
+//are pressed in order before the key and released in reverse after it. All
+//of them are queued together, so they reach the X server with one flush and
+//no application sees a part of the chord.
+void sendchord(const FakeEvent& e, const QVector<int> &modifiers);
+//read a chord as written in layouts, "0xffe3+0xffe1+0x74": the modifier
+//keysyms, then the keysym (or mouse button) itself. false if it isn't one.
+bool readchord(const QString &word, bool mouse, QVector<int> &modifiers, int &code);
+//the other way around
+QString writechord(const QVector<int> &modifiers, bool mouse, int code);
+
+//where events end up. By default that's the X server, through XTest.
+class OutputSink {
+    public:
+        virtual ~OutputSink() {}
+        //take an event
+        virtual void send(const FakeEvent& e) = 0;
+        //pass on everything taken since the last flush
+        virtual void flush() {}
+        //send events that the receiver times itself (see sendsequence()),
+        //false if it can't
+        virtual bool sendSequence(const FakeEvent*, const int*, int) { return false; }
+};
+//send events to sink instead, 0 for the X server. The sink isn't owned.
+void setOutputSink(OutputSink *sink);
+//the sink that sends to the X server, to pass on to another one
+OutputSink *xtestOutput();
+//the longest an event may wait for others to be sent with it (msec). 0
+//means until the end of the batch.
+void setFlushWindow(int msec);
+//a batch of work is over: flush, unless a flush window is waited out
+void endbatch();
+//send whatever is queued right now
+void flushevents();
+
+//events that are known in advance can be timed by the X server, with the
+//delays XTest has for every event, instead of us waking up for each of them.
+//Off by default.
+void setServerTiming(bool on);
+bool serverTiming();
+//send events[0] delays[0] msec from now and every other one delays[i] msec
+//after the one before it, as one batch with one flush. Returns false if
+//server timing is off or the server is still busy with an earlier sequence
+//(the server waits out a delay before anything else we send, so sequences
+//can't overlap); the caller has to time the events itself then.
+bool sendsequence(const FakeEvent *events, const int *delays, int count);
+//press a key or mouse button now and let go of it after down usec
+bool sendpulse(bool mouse, int code, qint64 down,
+               const QVector<int> &modifiers = QVector<int>());
 
 #endif
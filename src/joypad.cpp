@@ -1,6 +1,9 @@
 #include <QApplication>
+#include <QRegExp>
+#include <QStringList>
 
 #include "joypad.h"
+#include "keymap.h"
 
 //for actually interacting with the joystick devices
 #include <linux/joystick.h>
@@ -12,16 +15,39 @@
 #include <string.h>
 #include <stdint.h>
 
-JoyPad::JoyPad( int i, int dev, QObject *parent )
-    : QObject(parent), joydev(-1), axisCount(0), buttonCount(0), jpw(0), readNotifier(0), errorNotifier(0) {
+#include <algorithm>
+
+#include "stats.h"
+#include "event.h"
+
+//how many events are read at once
+#define JS_READ_EVENTS 64
+
+static Stat syncEvents("Initial state events absorbed");
+static Stat resyncs("Resyncs after dropped events");
+static Stat wakeups("Joystick wakeups");
+static Stat combosFired("Combos");
+static Stat heldBackPresses("Button presses held back for combos");
+static Stat layerSwitches("Layer switches");
+
+JoyPad::JoyPad( int i, int dev, const DeviceInfo &devInfo, QObject *parent )
+    : QObject(parent), joydev(-1), axisCount(0), buttonCount(0), jpw(0), readNotifier(0), errorNotifier(0), health(Closed), syncing(false), resyncing(false), syncCount(0), hasOrigCorr(false), corrected(false), calibrating(false) {
     debug_mesg("Constructing the joypad device with index %d and fd %d\n", i, dev);
     //remember the index,
     index = i;
+    comboButtons = 0;
+    comboWindow = COMBOWINDOW;
+    heldBack = comboReleases = 0;
+    heldBackTime = 0;
+    heldBackDue = 0;
+    comboDown = false;
+    layer = 0;
+    compileLayers();
 
     //load data from the joystick device, if available.
     if (dev >= 0) {
         debug_mesg("Valid file handle, setting up handlers and reading axis configs...\n");
-        open(dev);
+        open(dev, devInfo);
         debug_mesg("done resetting and setting up device index %d\n", i);
     } else {
         debug_mesg("This joypad does not have a valid file handle, not setting up event listeners\n");
@@ -30,17 +56,40 @@ JoyPad::JoyPad( int i, int dev, QObject *parent )
 }
 
 JoyPad::~JoyPad() {
+    Scheduler::instance()->cancel(this);
     close();
 }
 
 void JoyPad::close() {
+    int dev = detach();
+    if (dev >= 0) {
+        if (::close(dev) != 0) {
+            debug_mesg("close(js%d %d): %s\n", index, dev, strerror(errno));
+        }
+    }
+}
+
+int JoyPad::detach() {
+    //leave the device as we found it
+    if (corrected && joydev >= 0) {
+        if (ioctl(joydev, JSIOCSCORR, origCorr) < 0) {
+            debug_mesg("JSIOCSCORR(js%d): %s\n", index, strerror(errno));
+        }
+    }
+    corrected = false;
+    hasOrigCorr = false;
+    foreach (Axis *axis, axes) {
+        axis->setKernelDZone(0, 0);
+    }
+
     if (readNotifier) {
         disconnect(readNotifier, 0, 0, 0);
 
         readNotifier->blockSignals(true);
         readNotifier->setEnabled(false);
 
-        delete readNotifier;
+        //this might be called from within the notifier's own signal
+        readNotifier->deleteLater();
         readNotifier = 0;
     }
     if (errorNotifier) {
@@ -49,37 +98,27 @@ void JoyPad::close() {
         errorNotifier->blockSignals(true);
         errorNotifier->setEnabled(false);
 
-        delete errorNotifier;
+        errorNotifier->deleteLater();
         errorNotifier = 0;
     }
-    if (joydev >= 0) {
-        if (::close(joydev) != 0) {
-            debug_mesg("close(js%d %d): %s\n", index, joydev, strerror(errno));
-        }
-        joydev = -1;
-    }
+    int dev = joydev;
+    joydev = -1;
+    health = Closed;
+    return dev;
 }
 
-void JoyPad::open(int dev) {
+void JoyPad::open(int dev, const DeviceInfo &devInfo) {
     debug_mesg("resetting to dev\n");
     //remember the device file descriptor
     close();
     joydev = dev;
+    info = devInfo;
+    health = Open;
+    startSync();
 
-    char id[256];
-    memset(id, 0, sizeof(id));
-    if (ioctl(joydev, JSIOCGNAME(sizeof(id)), id) < 0) {
-        deviceId = "Unknown";
-    }
-    else {
-        deviceId = id;
-    }
-
-    //read in the number of axes / buttons
-    axisCount = 0;
-    ioctl (joydev, JSIOCGAXES, &axisCount);
-    buttonCount = 0;
-    ioctl (joydev, JSIOCGBUTTONS, &buttonCount);
+    //the number of axes / buttons was read in when the device was probed
+    axisCount = info.axisCount;
+    buttonCount = info.buttonCount;
     //make sure that we have the axes we need.
     //if one that we need doesn't yet exist, add it in.
     //Note: if the current layout has a key assigned to an axis that did not
@@ -87,26 +126,28 @@ void JoyPad::open(int dev) {
     //that axis into use, the key assignment will not be lost because the axis
     //will already exist and no new axis will be created.
     for (int i = axes.size(); i < axisCount; i++) {
-        axes.append(new Axis( i, this ));
+        axes.append(newAxis(i));
     }
     for (int i = buttons.size(); i < buttonCount; i++) {
         buttons.append(new Button( i, this ));
     }
+    compileLayers();
     debug_mesg("Setting up joyDeviceListeners\n");
     readNotifier = new QSocketNotifier(joydev, QSocketNotifier::Read, this);
     connect(readNotifier, SIGNAL(activated(int)), this, SLOT(handleJoyEvents()));
     errorNotifier = new QSocketNotifier(joydev, QSocketNotifier::Exception, this);
-    connect(errorNotifier, SIGNAL(activated(int)), this, SLOT(handleJoyEvents()));
+    connect(errorNotifier, SIGNAL(activated(int)), this, SLOT(errorRead()));
     debug_mesg("Done setting up joyDeviceListeners\n");
+    applyCorrections();
     debug_mesg("done resetting to dev\n");
 }
 
 const QString &JoyPad::getDeviceId() const {
-    return deviceId;
+    return info.name;
 }
 
 QString JoyPad::getName() const {
-    return tr("Joystick %1 (%2)").arg(index+1).arg(deviceId);
+    return tr("Joystick %1 (%2)").arg(index+1).arg(info.name);
 }
 
 int JoyPad::getIndex() const {
@@ -121,6 +162,78 @@ void JoyPad::toDefault() {
     foreach (Button *button, buttons) {
         button->toDefault();
     }
+    releaseCombo();
+    combos.clear();
+    comboParts.clear();
+    comboButtons = 0;
+    comboWindow = COMBOWINDOW;
+    clearLayers();
+    compileLayers();
+    qDeleteAll(sticks);
+    sticks.clear();
+    stickAxes.clear();
+    applyCorrections();
+}
+
+Axis *JoyPad::newAxis( int i ) {
+    Axis *axis = new Axis(i, this);
+    connect(axis, SIGNAL(changed()), this, SLOT(applyCorrections()));
+    return axis;
+}
+
+void JoyPad::applyCorrections() {
+    if (joydev < 0) return;
+
+    if (!hasOrigCorr) {
+        //joydev copies one js_corr for every axis the device has.
+        memset(origCorr, 0, sizeof(origCorr));
+        if (ioctl(joydev, JSIOCGCORR, origCorr) < 0) {
+            debug_mesg("JSIOCGCORR(js%d): %s\n", index, strerror(errno));
+            return;
+        }
+        hasOrigCorr = true;
+    }
+
+    //joydev maps a raw value v to coef[2] * (v - coef[0]) >> 14 below
+    //coef[0], to coef[3] * (v - coef[1]) >> 14 above coef[1] and to 0 in
+    //between. Moving coef[0] and coef[1] apart by the dead zone keeps the
+    //slopes, so values outside the dead zone are just shifted towards 0
+    //(Axis::uncorrect shifts them back) and the jitter inside it all
+    //becomes 0, which joydev doesn't report more than once.
+    struct js_corr corr[ABS_CNT];
+    memcpy(corr, origCorr, sizeof(corr));
+    bool any = false;
+    for (int i = 0; i < axes.size() && i < axisCount && i < ABS_CNT; ++ i) {
+        int dz = calibrating ? 0 : axes[i]->wantedKernelDZone();
+        struct js_corr &c = corr[i];
+        if (dz > 0 && c.type == JS_CORR_BROKEN && c.coef[2] > 0 && c.coef[3] > 0) {
+            int neg = (dz << 14) / c.coef[2];
+            int pos = (dz << 14) / c.coef[3];
+            c.coef[0] -= neg;
+            c.coef[1] += pos;
+            //the shift that results from moving by whole raw units
+            axes[i]->setKernelDZone((neg * c.coef[2]) >> 14, (pos * c.coef[3]) >> 14);
+            any = true;
+        }
+        else {
+            axes[i]->setKernelDZone(0, 0);
+        }
+    }
+
+    if (!any && !corrected) return;
+    if (ioctl(joydev, JSIOCSCORR, corr) < 0) {
+        debug_mesg("JSIOCSCORR(js%d): %s\n", index, strerror(errno));
+        foreach (Axis *axis, axes) {
+            axis->setKernelDZone(0, 0);
+        }
+        return;
+    }
+    corrected = any;
+}
+
+void JoyPad::setCalibrating( bool on ) {
+    calibrating = on;
+    applyCorrections();
 }
 
 bool JoyPad::isDefault() {
@@ -131,7 +244,7 @@ bool JoyPad::isDefault() {
     foreach (Button *button, buttons) {
         if (!button->isDefault()) return false;
     }
-    return true;
+    return combos.isEmpty() && comboWindow == COMBOWINDOW && shifts.isEmpty() && layers.isEmpty() && sticks.isEmpty();
 }
 
 bool JoyPad::readConfig( QTextStream &stream ) {
@@ -140,6 +253,8 @@ bool JoyPad::readConfig( QTextStream &stream ) {
     QString word;
     QChar ch = 0;
     int num = 0;
+    //the layer the axes and buttons that follow belong to
+    int readLayer = 0;
 
     stream >> word;
     while (!word.isNull() && word != "}") {
@@ -155,7 +270,8 @@ bool JoyPad::readConfig( QTextStream &stream ) {
                 for (int i = buttons.size(); i < num; ++ i) {
                     buttons.append(new Button(i, this));
                 }
-                if (!buttons[num-1]->read( stream )) {
+                Button *button = readLayer ? layerButton(readLayer, num-1) : buttons[num-1];
+                if (!button->read( stream )) {
                     errorBox(tr("Layout file error"), tr("Error reading Button %1").arg(num));
                     return false;
                 }
@@ -164,6 +280,119 @@ bool JoyPad::readConfig( QTextStream &stream ) {
                 stream.readLine();
             }
         }
+        //Combo 5+6: key 0xffc9
+        else if (word == "combo") {
+            QRegExp regex("^\\s*(\\d+(?:\\s*\\+\\s*\\d+)+)\\s*:\\s*(key|mouse)\\s+(\\w+)\\s*$", Qt::CaseInsensitive);
+            QString line = stream.readLine();
+            if (!regex.exactMatch(line)) {
+                errorBox(tr("Layout file error"), tr("Error reading Combo %1").arg(line.trimmed()));
+                return false;
+            }
+            quint64 mask = 0;
+            int count = 0;
+            foreach (const QString& number, regex.cap(1).split('+')) {
+                num = number.trimmed().toInt();
+                if (num < 1 || num > 64) {
+                    errorBox(tr("Layout file error"), tr("Combos can only be made of buttons 1 to 64."));
+                    return false;
+                }
+                const quint64 bit = Q_UINT64_C(1) << (num - 1);
+                //5+5 would be a single button, and be written back as one
+                if (mask & bit) {
+                    errorBox(tr("Layout file error"), tr("Error reading Combo %1").arg(line.trimmed()));
+                    return false;
+                }
+                mask |= bit;
+                ++ count;
+            }
+            Combo combo;
+            combo.useMouse = regex.cap(2).toLower() == "mouse";
+            bool ok = true;
+            if (combo.useMouse) {
+                combo.keycode = regex.cap(3).toInt(&ok);
+                if (combo.keycode < 0 || combo.keycode > MAXKEY) ok = false;
+            }
+            else {
+                ok = readkey(regex.cap(3).toLower(), combo.keycode);
+            }
+            if (count > MAXCOMBOBUTTONS || !ok) {
+                errorBox(tr("Layout file error"), tr("Error reading Combo %1").arg(line.trimmed()));
+                return false;
+            }
+            addCombo(mask, combo);
+        }
+        else if (word == "combowindow") {
+            stream >> num;
+            if (num < 0 || num > MAXCOMBOWINDOW) {
+                errorBox(tr("Layout file error"), tr("Combo window out of range: %1").arg(num));
+                return false;
+            }
+            comboWindow = num;
+        }
+        //Stick 1+2: radialDZone, maxSpeed 100
+        else if (word == "stick") {
+            int xAxis = 0, yAxis = 0;
+            stream >> xAxis >> ch >> yAxis;
+            if (ch != '+' || xAxis < 1 || yAxis < 1 || xAxis == yAxis) {
+                errorBox(tr("Layout file error"), tr("A stick is made of two different axes, like 'Stick 1+2:'."));
+                return false;
+            }
+            stream >> ch;
+            if (ch != ':') {
+                errorBox(tr("Layout file error"), tr("Expected ':', found '%1'.").arg(ch));
+                return false;
+            }
+            if (stickAxes.contains(xAxis - 1) || stickAxes.contains(yAxis - 1)) {
+                errorBox(tr("Layout file error"), tr("Axis %1 or %2 is already part of a stick.").arg(xAxis).arg(yAxis));
+                return false;
+            }
+            for (int i = axes.size(); i < std::max(xAxis, yAxis); ++ i) {
+                axes.append(newAxis(i));
+            }
+            Stick *stick = new Stick(xAxis - 1, yAxis - 1, this);
+            sticks.append(stick);
+            stickAxes.insert(xAxis - 1, stick);
+            stickAxes.insert(yAxis - 1, stick);
+            if (!stick->read(stream)) {
+                errorBox(tr("Layout file error"), tr("Error reading Stick %1+%2").arg(xAxis).arg(yAxis));
+                return false;
+            }
+        }
+        //Layer 2
+        else if (word == "layer") {
+            stream >> num;
+            if (num < 1 || num > MAXLAYERS) {
+                errorBox(tr("Layout file error"), tr("Layers can only be numbered 1 to %1.").arg(MAXLAYERS));
+                return false;
+            }
+            readLayer = num - 1;
+        }
+        //Shift 7: layer 2, toggle, carry
+        else if (word == "shift") {
+            QRegExp regex("^\\s*(\\d+)\\s*:\\s*layer\\s+(\\d+)((?:\\s*,\\s*(?:hold|toggle|release|carry))*)\\s*$", Qt::CaseInsensitive);
+            QString line = stream.readLine();
+            if (!regex.exactMatch(line)) {
+                errorBox(tr("Layout file error"), tr("Error reading Shift %1").arg(line.trimmed()));
+                return false;
+            }
+            num = regex.cap(1).toInt();
+            Shift shift;
+            shift.layer = regex.cap(2).toInt() - 1;
+            const QString options = regex.cap(3).toLower();
+            shift.toggle = options.contains("toggle");
+            shift.carry = options.contains("carry");
+            shift.down = false;
+            if (num < 1 || shift.layer < 1 || shift.layer >= MAXLAYERS) {
+                errorBox(tr("Layout file error"), tr("Error reading Shift %1").arg(line.trimmed()));
+                return false;
+            }
+            for (int i = buttons.size(); i < num; ++ i) {
+                buttons.append(new Button(i, this));
+            }
+            //a layer that only changes what the shift buttons do is still one
+            while (layers.size() < shift.layer) layers.append(Layer());
+            shifts.insert(num - 1, shift);
+        }
         else if (word == "axis") {
             stream >> num;
             if (num > 0) {
@@ -173,9 +402,10 @@ bool JoyPad::readConfig( QTextStream &stream ) {
                     return false;
                 }
                 for (int i = axes.size(); i < num; ++ i) {
-                    axes.append(new Axis(i, this));
+                    axes.append(newAxis(i));
                 }
-                if (!axes[num-1]->read(stream)) {
+                Axis *axis = readLayer ? layerAxis(readLayer, num-1) : axes[num-1];
+                if (!axis->read(stream)) {
                     errorBox(tr("Layout file error"), tr("Error reading Axis %1").arg(num));
                     return false;
                 }
@@ -187,13 +417,23 @@ bool JoyPad::readConfig( QTextStream &stream ) {
         }
         stream >> word;
     }
+    compileLayers();
+    applyCorrections();
     return true;
 }
 
 //only actually writes something if this JoyPad is NON DEFAULT.
 void JoyPad::write( QTextStream &stream ) {
     if (!axes.empty() || !buttons.empty()) {
-        stream << "Joystick " << (index+1) << " {\n";
+        //bind the layout to the device that is currently plugged in here,
+        //or keep the binding we read if there is none.
+        QString identity = isOpen() ? info.identity() : binding;
+        stream << "Joystick " << (index+1);
+        if (!identity.isEmpty()) {
+            identity.replace('\\', "\\\\").replace('"', "\\\"");
+            stream << " \"" << identity << "\"";
+        }
+        stream << " {\n";
         foreach (Axis *axis, axes) {
             if (!axis->isDefault()) {
                 axis->write(stream);
@@ -204,6 +444,40 @@ void JoyPad::write( QTextStream &stream ) {
                 button->write(stream);
             }
         }
+        if (comboWindow != COMBOWINDOW) {
+            stream << "\tComboWindow " << comboWindow << "\n";
+        }
+        for (QHash<quint64, Combo>::const_iterator it = combos.begin(); it != combos.end(); ++ it) {
+            QStringList numbers;
+            for (int i = 0; i < 64; ++ i) {
+                if (it.key() & (Q_UINT64_C(1) << i)) numbers.append(QString::number(i + 1));
+            }
+            stream << "\tCombo " << numbers.join("+") << ": "
+                   << (it.value().useMouse ? "mouse " : "key ")
+                   << (it.value().useMouse ? QString::number(it.value().keycode) : writekey(it.value().keycode)) << "\n";
+        }
+        for (int i = 0; i < buttons.size(); ++ i) {
+            if (!shifts.contains(i)) continue;
+            const Shift& shift = shifts[i];
+            stream << "\tShift " << (i + 1) << ": layer " << (shift.layer + 1)
+                   << (shift.toggle ? ", toggle" : ", hold")
+                   << (shift.carry ? ", carry" : ", release") << "\n";
+        }
+        foreach (Stick *stick, sticks) {
+            stick->write(stream);
+        }
+        //everything after this belongs to a layer, so it goes last
+        for (int l = 1; l <= layers.size(); ++ l) {
+            const Layer& current = layers[l-1];
+            if (current.axes.isEmpty() && current.buttons.isEmpty()) continue;
+            stream << "\tLayer " << (l + 1) << "\n";
+            for (int i = 0; i < axes.size(); ++ i) {
+                if (current.axes.contains(i)) current.axes[i]->write(stream);
+            }
+            for (int i = 0; i < buttons.size(); ++ i) {
+                if (current.buttons.contains(i)) current.buttons[i]->write(stream);
+            }
+        }
         stream << "}\n\n";
     }
 }
@@ -215,9 +489,97 @@ void JoyPad::release() {
     foreach (Button *button, buttons) {
         button->release();
     }
+    foreach (const Layer& current, layers) {
+        foreach (Axis *axis, current.axes) {
+            axis->release();
+        }
+        foreach (Button *button, current.buttons) {
+            button->release();
+        }
+    }
+    foreach (Stick *stick, sticks) {
+        stick->release();
+    }
+    releaseCombo();
+    Scheduler::instance()->cancel(this);
+    heldBack = comboReleases = 0;
+    //back to the base layer, with nothing carried over
+    layer = 0;
+    axisOwner.fill(-1);
+    buttonOwner.fill(-1);
+    for (QHash<int, Shift>::iterator it = shifts.begin(); it != shifts.end(); ++ it) {
+        it->down = false;
+    }
+}
+
+void JoyPad::startSync() {
+    syncing = true;
+    resyncing = false;
+    syncCount = 0;
+}
+
+void JoyPad::sync(const js_event &msg) {
+    unsigned int type = msg.type & ~JS_EVENT_INIT;
+    if (type == JS_EVENT_AXIS) {
+        Stick *stick = stickAxes.value(msg.number);
+        if (stick) stick->sync(msg.number, msg.value);
+        else if (msg.number < axes.size()) axes[msg.number]->sync(axes[msg.number]->uncorrect(msg.value));
+    }
+    else if (type == JS_EVENT_BUTTON) {
+        QHash<int, Shift>::iterator shift = shifts.find(msg.number);
+        if (shift != shifts.end()) shift->down = (msg.value == 1);
+        else if (msg.number < buttons.size()) buttons[msg.number]->sync(msg.value);
+    }
+    ++ syncCount;
 }
 
 void JoyPad::jsevent(const js_event &msg) {
+    //undo the shift of a dead zone that joydev applies for us
+    js_event plain = msg;
+    unsigned int type = msg.type & ~JS_EVENT_INIT;
+    if (type == JS_EVENT_AXIS && msg.number < axes.size()) {
+        plain.value = axes[msg.number]->uncorrect(msg.value);
+    }
+    //whatever is done with it, this is the state the device is in now
+    QVector<int>& values = (type == JS_EVENT_AXIS) ? axisValues : buttonValues;
+    if (msg.number >= values.size()) values.resize(msg.number + 1);
+    values[msg.number] = plain.value;
+
+    //when opened, the device first reports the state of every axis and
+    //button. A trigger that's already half pulled is no reason to press a
+    //key, so just remember all that; only real changes generate events.
+    bool resync = false;
+    if (msg.type & JS_EVENT_INIT) {
+        if (syncing) {
+            sync(msg);
+            return;
+        }
+        //once synced, joydev only reports the whole state again if our
+        //buffer overflowed and it had to drop events (that's its version of
+        //evdev's SYN_DROPPED). Whatever changed meanwhile, like a button
+        //that got let go of, has to be caught up on now, so this state is
+        //passed on as regular events; anything that didn't change won't do
+        //a thing.
+        if (!resyncing) {
+            debug_mesg("js%d: events were dropped, resyncing\n", index);
+            resyncs.count();
+            resyncing = true;
+        }
+        resync = true;
+    }
+    else {
+        if (syncing) {
+            debug_mesg("js%d: initial state of %d axes/buttons synced\n", index, syncCount);
+            syncEvents.count(syncCount);
+            syncing = false;
+        }
+        resyncing = false;
+    }
+
+    jsdispatch(plain, resync);
+}
+
+void JoyPad::jsdispatch(const js_event &msg, bool resync) {
     //if there is a JoyPadWidget around, ie, if the joypad is being edited
     if (jpw != NULL && hasFocus) {
         //tell the dialog there was an event. It will use this to flash
@@ -235,17 +597,228 @@ void JoyPad::jsevent(const js_event &msg) {
     if (type == JS_EVENT_AXIS) {
         debug_mesg("DEBUG: passing on an axis event\n");
         debug_mesg("DEBUG: %d %d\n", msg.number, msg.value);
-        if (msg.number < axes.size()) axes[msg.number]->jsevent(msg.value);
+        Stick *stick = stickAxes.value(msg.number);
+        if (stick) stick->jsevent(msg.number, msg.value);
+        else if (msg.number < axisOwner.size()) axisEvent(msg.number, msg.value);
         else debug_mesg("DEBUG: axis index out of range: %d\n", msg.value);
     }
     else if (type == JS_EVENT_BUTTON) {
         debug_mesg("DEBUG: passing on a button event\n");
         debug_mesg("DEBUG: %d %d\n", msg.number, msg.value);
-        if (msg.number < buttons.size()) buttons[msg.number]->jsevent(msg.value);
+        if (msg.number < buttonOwner.size()) {
+            QHash<int, Shift>::iterator shift = shifts.find(msg.number);
+            if (shift != shifts.end()) shiftEvent(*shift, msg.value);
+            else if (resync) {
+                //a button that is held back or part of a fired combo belongs
+                //to the combo: it still has to learn about a dropped release
+                const bool inCombo = msg.number < 64 && ((heldBack | comboReleases) & (Q_UINT64_C(1) << msg.number));
+                if (!inCombo) buttonEvent(msg.number, msg.value, msg.time, true);
+                else if (!msg.value && !comboEvent(msg)) buttonEvent(msg.number, msg.value, msg.time, true);
+            }
+            else if (!comboEvent(msg)) buttonEvent(msg.number, msg.value, msg.time, false);
+        }
         else debug_mesg("DEBUG: button index out of range: %d\n", msg.value);
     }
 }
 
+void JoyPad::addCombo( quint64 mask, const Combo& combo ) {
+    combos.insert(mask, combo);
+    comboButtons |= mask;
+    //every non-empty part of the mask other than the whole
+    for (quint64 part = (mask - 1) & mask; part != 0; part = (part - 1) & mask) {
+        comboParts.insert(part);
+    }
+}
+
+bool JoyPad::comboEvent( const js_event& msg ) {
+    if (msg.number >= 64) return false;
+    const quint64 bit = Q_UINT64_C(1) << msg.number;
+    if (!(comboButtons & bit)) return false;
+
+    if (msg.value) {
+        //too long after the first one to be pressed together with it
+        if (heldBack && (qint32) (msg.time - heldBackTime) > comboWindow) {
+            flushHeldBack();
+        }
+        if (!heldBack) {
+            heldBackTime = msg.time;
+            heldBackDue = Scheduler::fromEventTime(heldBackTime) + (qint64) comboWindow * 1000;
+        }
+        heldBack |= bit;
+        pressTimes[msg.number] = msg.time;
+        heldBackPresses.count();
+        //could still become a (bigger) combo: wait for the rest of it
+        if (comboParts.contains(heldBack)) {
+            Scheduler::instance()->schedule(this, heldBackDue);
+        }
+        else if (combos.contains(heldBack)) {
+            fireCombo();
+        }
+        else {
+            flushHeldBack();
+        }
+        return true;
+    }
+
+    //the first button let go of ends the combo, the others' releases are
+    //just swallowed like their presses were
+    if (comboReleases & bit) {
+        comboReleases &= ~bit;
+        releaseCombo();
+        return true;
+    }
+    //let go of before it was clear: it's a press of its own after all
+    if (heldBack & bit) {
+        flushHeldBack();
+    }
+    return false;
+}
+
+void JoyPad::timeout( qint64 ) {
+    if (!heldBack) return;
+    if (combos.contains(heldBack)) fireCombo();
+    else flushHeldBack();
+}
+
+void JoyPad::fireCombo() {
+    Scheduler::instance()->cancel(this);
+    releaseCombo();
+    combosFired.count();
+    downCombo = combos.value(heldBack);
+    comboDown = true;
+    comboReleases |= heldBack;
+    heldBack = 0;
+
+    FakeEvent e;
+    e.type = downCombo.useMouse ? FakeEvent::MouseDown : FakeEvent::KeyDown;
+    e.keycode = downCombo.keycode;
+    sendevent(e);
+}
+
+void JoyPad::flushHeldBack() {
+    Scheduler::instance()->cancel(this);
+    const quint64 presses = heldBack;
+    heldBack = 0;
+    for (int i = 0; i < 64 && i < buttonOwner.size(); ++ i) {
+        if (presses & (Q_UINT64_C(1) << i)) buttonEvent(i, 1, pressTimes[i], false);
+    }
+}
+
+void JoyPad::releaseCombo() {
+    if (!comboDown) return;
+    comboDown = false;
+    FakeEvent e;
+    e.type = downCombo.useMouse ? FakeEvent::MouseUp : FakeEvent::KeyUp;
+    e.keycode = downCombo.keycode;
+    sendevent(e);
+}
+
+Axis *JoyPad::layerAxis( int l, int i ) {
+    while (layers.size() < l) layers.append(Layer());
+    Axis *&axis = layers[l-1].axes[i];
+    if (!axis) axis = newAxis(i);
+    return axis;
+}
+
+Button *JoyPad::layerButton( int l, int i ) {
+    while (layers.size() < l) layers.append(Layer());
+    Button *&button = layers[l-1].buttons[i];
+    if (!button) button = new Button(i, this);
+    return button;
+}
+
+void JoyPad::compileLayers() {
+    axisTable.fill(axes.toVector(), layers.size() + 1);
+    buttonTable.fill(buttons.toVector(), layers.size() + 1);
+    for (int l = 1; l <= layers.size(); ++ l) {
+        const Layer& current = layers[l-1];
+        for (QHash<int, Axis*>::const_iterator it = current.axes.begin(); it != current.axes.end(); ++ it) {
+            if (it.key() < axes.size()) axisTable[l][it.key()] = it.value();
+        }
+        for (QHash<int, Button*>::const_iterator it = current.buttons.begin(); it != current.buttons.end(); ++ it) {
+            if (it.key() < buttons.size()) buttonTable[l][it.key()] = it.value();
+        }
+    }
+    axisOwner.fill(-1, axes.size());
+    buttonOwner.fill(-1, buttons.size());
+    if (layer > layers.size()) layer = 0;
+}
+
+void JoyPad::clearLayers() {
+    //deleting them lets go of whatever they're holding
+    foreach (const Layer& current, layers) {
+        qDeleteAll(current.axes);
+        qDeleteAll(current.buttons);
+    }
+    layers.clear();
+    shifts.clear();
+    layer = 0;
+}
+
+void JoyPad::shiftEvent( Shift& shift, int value ) {
+    const bool down = (value == 1);
+    //a resync of a state that didn't change
+    if (down == shift.down) return;
+    shift.down = down;
+    if (shift.toggle) {
+        if (down) setLayer(layer == shift.layer ? 0 : shift.layer, shift.carry);
+    }
+    else if (down) {
+        setLayer(shift.layer, shift.carry);
+    }
+    //let go of a shift that is no longer in charge changes nothing
+    else if (layer == shift.layer) {
+        setLayer(0, shift.carry);
+    }
+}
+
+void JoyPad::setLayer( int l, bool carry ) {
+    if (l == layer || l >= axisTable.size()) return;
+    layerSwitches.count();
+    //only the axes and buttons that are mapped differently need a thought.
+    //Those carried over from before keep going where they went.
+    for (int i = 0; i < axisOwner.size(); ++ i) {
+        //coming back to the layer it was carried over from, which has been
+        //following it all along
+        const bool back = (axisOwner[i] == l);
+        if (back) axisOwner[i] = -1;
+        if (axisOwner[i] >= 0) continue;
+        Axis *from = axisTable[layer][i];
+        if (from == axisTable[l][i]) continue;
+        if (!carry) from->release();
+        else if (from->isActive()) axisOwner[i] = layer;
+        //an axis that is already pushed does nothing on the new layer
+        //until it is let go of and pushed again, like when opening the device
+        if (!back && axisOwner[i] < 0 && i < axisValues.size()) axisTable[l][i]->sync(axisValues[i]);
+    }
+    for (int i = 0; i < buttonOwner.size(); ++ i) {
+        const bool back = (buttonOwner[i] == l);
+        if (back) buttonOwner[i] = -1;
+        if (buttonOwner[i] >= 0) continue;
+        Button *from = buttonTable[layer][i];
+        if (from == buttonTable[l][i]) continue;
+        //the new button only does something once it's pressed again
+        if (!carry) from->release();
+        else if (from->isPressed()) buttonOwner[i] = layer;
+        if (!back && buttonOwner[i] < 0 && i < buttonValues.size()) buttonTable[l][i]->sync(buttonValues[i]);
+    }
+    layer = l;
+}
+
+void JoyPad::axisEvent( int i, int value ) {
+    Axis *axis = axisTable[axisOwner[i] >= 0 ? axisOwner[i] : layer][i];
+    axis->jsevent(value);
+    //a carried over axis comes back to the current layer once let go of
+    if (axisOwner[i] >= 0 && !axis->isActive()) axisOwner[i] = -1;
+}
+
+void JoyPad::buttonEvent( int i, int value, quint32 time, bool resync ) {
+    Button *button = buttonTable[buttonOwner[i] >= 0 ? buttonOwner[i] : layer][i];
+    if (resync) button->resync(value, time);
+    else button->jsevent(value, time);
+    if (buttonOwner[i] >= 0 && !button->isPressed()) buttonOwner[i] = -1;
+}
+
 JoyPadWidget* JoyPad::widget( QWidget* parent, int i) {
     //create the widget and remember it.
     jpw = new JoyPadWidget(this, i, parent);
@@ -253,13 +826,30 @@ JoyPadWidget* JoyPad::widget( QWidget* parent, int i) {
 }
 
 void JoyPad::handleJoyEvents() {
-    js_event msg;
-    ssize_t len = read(joydev, &msg, sizeof(js_event));
-    //if there was a real event waiting,
-    if (len == sizeof(js_event)) {
-        //pass that event on to the joypad!
-        jsevent(msg);
+    wakeups.count();
+    js_event msgs[JS_READ_EVENTS];
+    //read everything that's waiting, the initial state comes as one burst.
+    while (joydev >= 0) {
+        ssize_t len = read(joydev, msgs, sizeof(msgs));
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            //the device is gone (ENODEV) or broken.
+            if (errno != EAGAIN) {
+                debug_mesg("read(js%d %d): %s\n", index, joydev, strerror(errno));
+                errorRead();
+            }
+            break;
+        }
+        //pass the events on to the joypad! Stop if it got closed meanwhile
+        //(the QuickSet dialog runs an event loop from within jsevent).
+        int count = len / sizeof(js_event);
+        for (int i = 0; i < count && joydev >= 0; ++ i) {
+            jsevent(msgs[i]);
+        }
+        if (len < (ssize_t) sizeof(msgs)) break;
     }
+    //whatever all these events made goes out at once
+    endbatch();
 }
 
 void JoyPad::releaseWidget() {
@@ -268,9 +858,14 @@ void JoyPad::releaseWidget() {
 }
 
 void JoyPad::errorRead() {
+    if (joydev < 0) return;
     debug_mesg("There was an error reading off of the device with fd %d, disabling\n", joydev);
+    //don't leave any keys stuck down just because the device went away
+    release();
     close();
-    debug_mesg("Done disabling device with fd %d\n", joydev);
+    health = Lost;
+    debug_mesg("Done disabling device js%d\n", index);
+    emit lost(this);
 }
 
 void JoyPad::focusChange(bool focusState) {
@@ -4,29 +4,58 @@
 //parts of the joypad
 #include "button.h"
 #include "axis.h"
+#include "stick.h"
 
 //the widget that will edit this
 #include "joypadw.h"
 
 //for raising errors
 #include "error.h"
+//name, identity and dimensions of the device
+#include "deviceinfo.h"
+//for the combo deadline
+#include "scheduler.h"
 
 #include <QTextStream>
 #include <QList>
+#include <QHash>
+#include <QSet>
+#include <QVector>
 #include <QSocketNotifier>
 
+#include <linux/joystick.h>
+#include <linux/input.h>
+
 class JoyPadWidget;
 
+//how long the buttons of a combo may be pressed apart (msec), by default
+//and at most
+#define COMBOWINDOW 50
+#define MAXCOMBOWINDOW 1000
+//combos can be made of this many of the first 64 buttons
+#define MAXCOMBOBUTTONS 8
+//how many mappings a joypad can switch between, the base one included
+#define MAXLAYERS 8
+
 //represents an actual joystick device
-class JoyPad : public QObject {
+class JoyPad : public QObject, public Timed {
 	Q_OBJECT
     friend class JoyPadWidget;
 	friend class QuickSet;
+	friend class Calibration;
     public:
-        JoyPad( int i, int dev, QObject* parent );
+        //Closed: no device (never had one or it was removed)
+        //Open: the device is open and working
+        //Lost: the device failed, waiting for it to come back
+        enum Health {Closed, Open, Lost};
+
+        JoyPad( int i, int dev, const DeviceInfo& info, QObject* parent );
         ~JoyPad();
         // close file descriptor and socket notifier
         void close();
+        // stop listening to the device and hand over its file descriptor
+        // without closing it (used to move a device to another layout slot)
+        int detach();
         //read from a stream
 		bool readConfig( QTextStream &stream );
 		//write to a stream
@@ -35,15 +64,32 @@ class JoyPad : public QObject {
 		void release();
 		//handle an event from the joystick device this is associated with
         void jsevent( const js_event& msg );
+        //the next JS_EVENT_INIT events are the initial state, as after open()
+        void startSync();
+        //take on the initial state of an axis or button (JS_EVENT_INIT)
+        void sync( const js_event& msg );
+        //pass an event on to the editor or the axis/button it is for
+        void jsdispatch( const js_event& msg, bool resync );
+        //the time to tell held back buttons from a combo is up
+        void timeout( qint64 due );
 		//reset to default settings
 		void toDefault();
 		//true iff this is currently at default settings
         bool isDefault();
-		//read the dimensions on the real joystick and use them
-        void open( int dev );
+		//use the dimensions of the real joystick, as probed into info
+        void open( int dev, const DeviceInfo& info );
+        bool isOpen() const { return joydev >= 0; }
+        Health getHealth() const { return health; }
         const QString& getDeviceId() const;
+        const DeviceInfo& getDeviceInfo() const { return info; }
         QString getName() const;
         int getIndex() const;
+        //the device identity the layout binds this joypad to, if any
+        const QString& getBinding() const { return binding; }
+        void setBinding( const QString& identity ) { binding = identity; }
+        //while calibrating, joydev is told to pass on all the noise
+        //instead of applying the dead zones of the axes
+        void setCalibrating( bool on );
 		
     private:
 
@@ -73,12 +119,119 @@ class JoyPad : public QObject {
 		JoyPadWidget* jpw;
         QSocketNotifier *readNotifier;
         QSocketNotifier *errorNotifier;
-        QString deviceId;
+        DeviceInfo info;
+        QString binding;
+        Health health;
+        //true from opening the device until the initial state it reports
+        //(JS_EVENT_INIT events) has been taken on
+        bool syncing;
+        //true while the state is reported again after events were dropped
+        bool resyncing;
+        int syncCount;
+        //joydev's correction as it was when we opened the device, so it
+        //can be put back when we're done with it
+        struct js_corr origCorr[ABS_CNT];
+        bool hasOrigCorr;
+        //true iff we changed the correction
+        bool corrected;
+        bool calibrating;
+        //make a new axis that's set up like all the others
+        Axis *newAxis( int i );
+
+        //a key pressed while a set of buttons is held together
+        struct Combo {
+            bool useMouse;
+            int keycode;
+        };
+        //combos by the mask of their buttons (bit n = button n), and every
+        //part of such a mask that could still grow into one, so each event
+        //is a single lookup no matter how many combos there are.
+        QHash<quint64, Combo> combos;
+        QSet<quint64> comboParts;
+        //all buttons in any combo; the others never wait
+        quint64 comboButtons;
+        int comboWindow;
+        //buttons whose press is held back until it's clear if they're part
+        //of a combo, and buttons whose release belongs to the combo they
+        //made
+        quint64 heldBack;
+        quint64 comboReleases;
+        //kernel time of the first held back press, and of every one
+        quint32 heldBackTime;
+        quint32 pressTimes[64];
+        //when the combo window of the first one closes, on our clock
+        qint64 heldBackDue;
+        //the key of the combo that is going on, if any
+        bool comboDown;
+        Combo downCombo;
+        void addCombo( quint64 mask, const Combo& combo );
+        //returns true if the button event was taken care of
+        bool comboEvent( const js_event& msg );
+        //press the key of the combo the held back buttons make
+        void fireCombo();
+        //no combo: let the held back buttons be pressed after all
+        void flushHeldBack();
+        void releaseCombo();
+
+        //the axes and buttons of a layer that differ from the base mapping
+        //(axes/buttons); all the others are shared with it
+        struct Layer {
+            QHash<int, Axis*> axes;
+            QHash<int, Button*> buttons;
+        };
+        QList<Layer> layers;
+        //a button that switches to another layer instead of doing anything
+        //itself, either while it is held or until it's pressed again.
+        //carry: outputs that are held when switching stay on until they're
+        //let go of, instead of being released right away.
+        struct Shift {
+            int layer;
+            bool toggle;
+            bool carry;
+            //the state of the shift button itself
+            bool down;
+        };
+        QHash<int, Shift> shifts;
+        //for every layer, which object each axis/button is dispatched to.
+        //Built when the layout is loaded, so switching a layer is no more
+        //than changing the index.
+        QVector<QVector<Axis*> > axisTable;
+        QVector<QVector<Button*> > buttonTable;
+        //the layer an axis/button that was carried over is still going to,
+        //or -1 if it goes to the current one
+        QVector<int> axisOwner;
+        QVector<int> buttonOwner;
+        //the last known state of every axis (without joydev's dead zone)
+        //and button, to bring those of a layer switched to up to date
+        QVector<int> axisValues;
+        QVector<int> buttonValues;
+        int layer;
+        //the layer to read axes/buttons into, making them if need be
+        Axis *layerAxis( int l, int i );
+        Button *layerButton( int l, int i );
+        void compileLayers();
+        void clearLayers();
+        void shiftEvent( Shift& shift, int value );
+        void setLayer( int l, bool carry );
+        void axisEvent( int i, int value );
+        void buttonEvent( int i, int value, quint32 time, bool resync );
+
+        //pairs of axes that move the mouse together, and the stick each
+        //axis belongs to, if any. Sticks take over their axes on every layer.
+        QList<Stick*> sticks;
+        QHash<int, Stick*> stickAxes;
         bool hasFocus;
     public slots:    
         void handleJoyEvents();
+		//program joydev's correction for every axis that wants its dead
+		//zone applied in the kernel, or restore the original correction
+		//for those that don't
+		void applyCorrections();
         void errorRead();
         void focusChange(bool windowHasFocus);
+    signals:
+        //the device failed and was closed, its outputs have been released
+        void lost(JoyPad *joypad);
 };
 
 #endif
@@ -14,6 +14,7 @@ JoyPadWidget::JoyPadWidget( JoyPad* jp, int i, QWidget* parent )
     flashcount = 0;
     int insertCounter = 0;
     quickset = NULL;
+    calibration = NULL;
 
     foreach (Axis *axis, joypad->axes) {
         AxisWidget *aw = new AxisWidget(axis,this);
@@ -74,6 +75,14 @@ void JoyPadWidget::setAll() {
     quickset = NULL;
 }
 
+void JoyPadWidget::calibrate() {
+    calibration = new Calibration(joypad, this);
+    calibration->exec();
+    update();
+    delete calibration;
+    calibration = NULL;
+}
+
 void JoyPadWidget::jsevent( const js_event& msg ) {
     //notify the component this event applies to. this cannot generate anything
     //other than a flash  :)
@@ -90,4 +99,8 @@ void JoyPadWidget::jsevent( const js_event& msg ) {
     if (quickset != NULL) {
         quickset->jsevent(msg);
     }
+    //same for calibration
+    if (calibration != NULL) {
+        calibration->jsevent(msg);
+    }
 }
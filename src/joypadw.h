@@ -13,10 +13,13 @@
 #include "buttonw.h"
 //JoyPadWidget also is what initiates the whole QuickSet procedure  :)
 #include "quickset.h"
+//and the calibration
+#include "calibration.h"
 
 //because of some circularity issues, I need to forward declare these.
 class JoyPad;
 class QuickSet;
+class Calibration;
 
 //Widget for editing a JoyPad
 class JoyPadWidget : public QWidget {
@@ -36,6 +39,8 @@ class JoyPadWidget : public QWidget {
 		void clear();
 		//quickset!
 		void setAll();
+		//measure the idle noise and propose dead zones
+		void calibrate();
 	signals:
 		//happens whenever the tab that represents this joypadwidget should flash
 		//(either on or off) The int is the index of this widget so that this
@@ -60,6 +65,8 @@ class JoyPadWidget : public QWidget {
 		
 		//the quickset window, when we create it
 		QuickSet* quickset;
+		//the calibration window, likewise
+		Calibration* calibration;
 };
 
 #endif
@@ -1,15 +1,18 @@
-#include <QX11Info>
 #include "keycode.h"
 #include "keydialog.hpp"
+#include "keymap.h"
 #include <X11/XKBlib.h>
 
-const QString ktos( int keycode )
+const QString ktos( int keysym )
 {
-    if (keycode > MAXKEY || keycode < 0) keycode = 0;
+    if (keysym > MAXKEYSYM || keysym < 0) keysym = 0;
 
-    if (keycode == 0) return "[NO KEY]";
+    if (keysym == 0) return "[NO KEY]";
 
-    QString xname = XKeysymToString( XkbKeycodeToKeysym( QX11Info::display(), keycode, 0, 0 ) );
+    const char *name = XKeysymToString( keysym );
+    //a keysym that has no name of its own
+    if (!name) return QString("0x%1").arg(keysym, 0, 16);
+    QString xname = name;
 
 //this section of code converts standard X11 keynames into much nicer names
 //which are prettier, fit the dialogs better, and are more readily understandable.
@@ -10,8 +10,8 @@
 
 #include "constant.h"
 
-//Produce a string for any keycode
-const QString ktos( int keycode );
+//Produce a string for any keysym
+const QString ktos( int keysym );
 
 
 //a button that requests a keycode from the user when clicked.
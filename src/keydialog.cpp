@@ -1,4 +1,6 @@
 #include "keydialog.hpp"
+//the keysym of the key itself, whatever modifiers are on
+#include "keymap.h"
 
 #include <QGuiApplication>
 #include <QPointer>
@@ -45,7 +47,7 @@ void KeyDialog::keyReleaseEvent( QKeyEvent* event ) {
     if ( event->key() != Qt::Key_Control ) {
         return;
     }
-    m_value = event->nativeScanCode();
+    m_value = keycodetokeysym( event->nativeScanCode() );
     m_isMouse = false;
     accept();
 }
@@ -57,7 +59,7 @@ void KeyDialog::keyPressEvent( QKeyEvent* event ) {
     if ( event->key() == Qt::Key_X && QGuiApplication::keyboardModifiers() == Qt::ControlModifier ) {
         m_value = 0;
     } else {
-        m_value = event->nativeScanCode();
+        m_value = keycodetokeysym( event->nativeScanCode() );
     }
     m_isMouse = false;
     accept();
@@ -0,0 +1,148 @@
+#include <QAbstractNativeEventFilter>
+#include <QCoreApplication>
+#include <QHash>
+#include <QVector>
+#include <QX11Info>
+
+#include "keymap.h"
+#include "constant.h"
+#include "stats.h"
+#include "error.h"
+
+#include <X11/XKBlib.h>
+
+static Stat keymapBuilds("Keymap rebuilds");
+static Stat spareBindings("Keysyms bound to spare keycodes");
+
+//the keycode of every keysym that is on a key, and the keycodes that have
+//no keysym at all
+static QHash<int, int> keycodes;
+static QVector<int> spareKeycodes;
+//the spare keycodes we bound keysyms to, to give back at the end
+static QVector<int> boundKeycodes;
+static bool stale = true;
+//the first event number of the XKB extension, -1 without it
+static int xkbEventBase = -1;
+
+static void rebuild() {
+    stale = false;
+    keycodes.clear();
+    spareKeycodes.clear();
+    keymapBuilds.count();
+    Display *display = QX11Info::display();
+    int min, max, perKeycode;
+    XDisplayKeycodes(display, &min, &max);
+    KeySym *syms = XGetKeyboardMapping(display, min, max - min + 1, &perKeycode);
+    if (!syms) return;
+    //a keysym is looked for on the lowest level it is on (without
+    //modifiers, then with shift, ...), so XK_T is the key that types t
+    //too. Where it is on more than one key, the first one is taken.
+    for (int level = 0; level < perKeycode; ++ level) {
+        for (int code = min; code <= max; ++ code) {
+            const KeySym sym = syms[(code - min) * perKeycode + level];
+            if (sym != NoSymbol && !keycodes.contains(sym)) keycodes.insert(sym, code);
+        }
+    }
+    for (int code = min; code <= max; ++ code) {
+        bool empty = true;
+        for (int level = 0; level < perKeycode; ++ level) {
+            if (syms[(code - min) * perKeycode + level] != NoSymbol) empty = false;
+        }
+        if (empty) spareKeycodes.append(code);
+    }
+    XFree(syms);
+}
+
+//put keysym on a spare keycode, 0 if there's none left
+static int bind(int keysym) {
+    if (spareKeycodes.isEmpty()) {
+        debug_mesg("no spare keycode left for keysym 0x%x\n", (unsigned int) keysym);
+        return 0;
+    }
+    const int code = spareKeycodes.takeLast();
+    Display *display = QX11Info::display();
+    KeySym syms[2] = {(KeySym) keysym, (KeySym) keysym};
+    XChangeKeyboardMapping(display, code, 2, syms, 1);
+    //events go out on other connections, they must not get there before
+    //the new mapping does
+    XSync(display, False);
+    keycodes.insert(keysym, code);
+    boundKeycodes.append(code);
+    spareBindings.count();
+    return code;
+}
+
+void restorekeymap() {
+    if (boundKeycodes.isEmpty() || !QX11Info::isPlatformX11()) return;
+    Display *display = QX11Info::display();
+    KeySym none = NoSymbol;
+    foreach (int code, boundKeycodes) XChangeKeyboardMapping(display, code, 1, &none, 1);
+    XSync(display, False);
+    boundKeycodes.clear();
+    stale = true;
+}
+
+int keysymtokeycode(int keysym) {
+    if (keysym == NoSymbol) return 0;
+    if (!QX11Info::isPlatformX11()) return keysym;
+    if (stale) rebuild();
+    QHash<int, int>::const_iterator it = keycodes.constFind(keysym);
+    if (it != keycodes.constEnd()) return it.value();
+    return bind(keysym);
+}
+
+int keycodetokeysym(int keycode) {
+    if (keycode == 0 || !QX11Info::isPlatformX11()) return NoSymbol;
+    return XkbKeycodeToKeysym(QX11Info::display(), keycode, 0, 0);
+}
+
+//sees the events of Qt's connection before Qt does
+class KeymapWatcher : public QAbstractNativeEventFilter {
+    public:
+        bool nativeEventFilter( const QByteArray &eventType, void *message, long * ) {
+            if (eventType != "xcb_generic_event_t") return false;
+            //the layout of every X event: the type, then for XKB events
+            //which one of them it is
+            const unsigned char *event = static_cast<const unsigned char*>(message);
+            const int type = event[0] & 0x7f;
+            if (type == MappingNotify ||
+                (type == xkbEventBase && (event[1] == XkbMapNotify || event[1] == XkbNewKeyboardNotify))) {
+                stale = true;
+            }
+            return false;
+        }
+};
+static KeymapWatcher keymapWatcher;
+
+void watchkeymap() {
+    if (!QX11Info::isPlatformX11()) return;
+    Display *display = QX11Info::display();
+    int opcode, error, major = XkbMajorVersion, minor = XkbMinorVersion;
+    if (XkbQueryExtension(display, &opcode, &xkbEventBase, &error, &major, &minor)) {
+        const unsigned int events = XkbMapNotifyMask | XkbNewKeyboardNotifyMask;
+        XkbSelectEvents(display, XkbUseCoreKbd, events, events);
+    }
+    else {
+        xkbEventBase = -1;
+    }
+    QCoreApplication::instance()->installNativeEventFilter(&keymapWatcher);
+}
+
+bool readkey(const QString &word, int &keysym) {
+    bool ok;
+    if (word.startsWith("0x")) {
+        const int val = word.mid(2).toInt(&ok, 16);
+        if (!ok || val < 0 || val > MAXKEYSYM) return false;
+        keysym = val;
+        return true;
+    }
+    const int val = word.toInt(&ok);
+    if (!ok || val < 0 || val > MAXKEY) return false;
+    keysym = keycodetokeysym(val);
+    return true;
+}
+
+QString writekey(int keysym) {
+    if (keysym == NoSymbol) return "0";
+    return "0x" + QString::number(keysym, 16);
+}
@@ -0,0 +1,33 @@
+#ifndef QJOYPAD_KEYMAP_H
+#define QJOYPAD_KEYMAP_H
+
+#include <QString>
+
+//keys are kept as X keysyms (what a key types, like XK_t or XK_Control_L),
+//so layouts work the same with any keyboard layout. They are only turned
+//into keycodes when events are sent.
+//keysyms are at most 29 bits
+#define MAXKEYSYM 0x1fffffff
+
+//the keycode the keysym is on, through a table that is built when it's
+//first needed and again only after the keyboard mapping changed (see
+//watchkeymap()). A keysym that isn't on any key is bound to a spare keycode;
+//0 if there is none left. Without an X server there is nothing to map to and
+//the keysym is passed on as it is.
+int keysymtokeycode(int keysym);
+//the keysym on a keycode (without modifiers), for layouts that were written
+//with keycodes
+int keycodetokeysym(int keycode);
+//rebuild the table whenever the X server says the keyboard mapping changed
+//(MappingNotify, XkbMapNotify)
+void watchkeymap();
+//give back the spare keycodes keysyms were bound to
+void restorekeymap();
+
+//read a key as written in layouts: a keysym in hex ("0x74"), or a keycode
+//in decimal as layouts used to have them. false if it's neither.
+bool readkey(const QString &word, int &keysym);
+//a keysym as readkey() reads it
+QString writekey(int keysym);
+
+#endif
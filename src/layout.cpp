@@ -1,15 +1,29 @@
 #include <cassert>
+#include <algorithm>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFileDialog>
 #include <QSettings>
 
 #include "layout.h"
 #include "config.h"
+#include "stats.h"
+
+static Stat refreshTime("Device list refreshes", " us");
+static Stat probeTime("Device probes", " us");
+static Stat deviceErrors("Device errors");
+static Stat reconnectTime("Device reconnects", " ms");
+#ifdef WITH_LIBUDEV
+static Stat udevEvents("UDev joystick events");
+static Stat udevBatchSize("UDev batches", " devices");
+#endif
 
 //initialize things and set up an icon  :)
 LayoutManager::LayoutManager( bool useTrayIcon, const QString &devdir, const QString &settingsDir )
@@ -18,12 +32,19 @@ LayoutManager::LayoutManager( bool useTrayIcon, const QString &devdir, const QSt
       layoutGroup(new QActionGroup(this)),
       updateDevicesAction(new QAction(QIcon::fromTheme("view-refresh"),tr("Update &Joystick Devices"),this)),
       updateLayoutsAction(new QAction(QIcon::fromTheme("view-refresh"),tr("Update &Layout List"),this)),
+      statsAction(new QAction(QIcon::fromTheme("dialog-information"),tr("&Statistics"),this)),
       quitAction(new QAction(QIcon::fromTheme("application-exit"),tr("&Quit"),this)),
     m_showMenuBar( true ),
     m_showToolBar( true ),
     m_useTrayIconFromTheme( false )
 {
     settingsLoad();
+    prober = new DeviceProber(this);
+    probeSerial = 0;
+    connect(prober, &DeviceProber::probed, this, &LayoutManager::joyPadProbed);
+    connect(prober, &DeviceProber::failed, this, &LayoutManager::joyPadProbeFailed);
+    reconnectTimer.setSingleShot(true);
+    connect(&reconnectTimer, &QTimer::timeout, this, &LayoutManager::reconnectLost);
 #ifdef WITH_LIBUDEV
     udevNotifier = 0;
     udev = 0;
@@ -44,6 +65,7 @@ LayoutManager::LayoutManager( bool useTrayIcon, const QString &devdir, const QSt
 
     connect(updateLayoutsAction, SIGNAL(triggered()), this, SLOT(fillPopup()));
     connect(updateDevicesAction, SIGNAL(triggered()), this, SLOT(updateJoyDevs()));
+    connect(statsAction, SIGNAL(triggered()), this, SLOT(showStats()));
     connect(quitAction, SIGNAL(triggered()), this, SLOT( requestQuit() ) );
 
     //no layout loaded at start.
@@ -108,6 +130,9 @@ bool LayoutManager::initUDev() {
 
             udevNotifier = new QSocketNotifier(udev_monitor_get_fd(monitor), QSocketNotifier::Read, this);
             connect(udevNotifier, SIGNAL(activated(int)), this, SLOT(udevUpdate()));
+            udevBatchTimer.setSingleShot(true);
+            udevBatchTimer.setInterval(UDEV_BATCH_MSEC);
+            connect(&udevBatchTimer, SIGNAL(timeout()), this, SLOT(applyUdevBatch()));
             debug_mesg("notifier ok\n");
         }
         else {
@@ -120,36 +145,78 @@ bool LayoutManager::initUDev() {
 }
 
 void LayoutManager::udevUpdate() {
-    struct udev_device *dev = udev_monitor_receive_device(monitor);
-    if (dev) {
-        QRegExp devicename("/js(\\d+)$");
+    //drain the monitor, there might be more than one event waiting
+    QRegExp devicename("/js(\\d+)$");
+    struct udev_device *dev;
+    while ((dev = udev_monitor_receive_device(monitor)) != 0) {
         QString path = udev_device_get_devnode(dev);
         const char *action = udev_device_get_action(dev);
 
-        if (devicename.indexIn(path) >= 0) {
+        if (action && devicename.indexIn(path) >= 0) {
             int index = devicename.cap(1).toInt();
 
-            if (strcmp(action,"add") == 0 || strcmp(action,"online") == 0) {
-                addJoyPad(index, path);
+            //only the last state of a device matters: a device that got
+            //removed and added again is simply opened anew.
+            if (strcmp(action,"add") == 0 || strcmp(action,"online") == 0 ||
+                    strcmp(action,"change") == 0) {
+                udevPending.insert(index, path);
             }
             else if (strcmp(action,"remove") == 0 || strcmp(action,"offline") == 0) {
-                removeJoyPad(index);
-            }
-            else if (strcmp(action,"change") == 0) {
-                removeJoyPad(index);
-                addJoyPad(index, path);
+                udevPending.insert(index, QString());
             }
+            udevEvents.count();
 
-            fillPopup();
-            if (le) {
-                le->updateJoypadWidgets();
+            //don't restart the timer on every event, so a steady stream of
+            //events can't hold off the update forever.
+            if (!udevBatchTimer.isActive()) {
+                udevBatchTimer.start();
             }
         }
         udev_device_unref(dev);
     }
 }
+
+void LayoutManager::applyUdevBatch() {
+    if (udevPending.isEmpty()) return;
+
+    //removals first, so the slots they free can be taken by the new devices
+    for (QHash<int, QString>::const_iterator it = udevPending.constBegin(); it != udevPending.constEnd(); ++ it) {
+        if (it.value().isNull()) {
+            removeJoyPad(it.key());
+        }
+    }
+    for (QHash<int, QString>::const_iterator it = udevPending.constBegin(); it != udevPending.constEnd(); ++ it) {
+        if (!it.value().isNull()) {
+            addJoyPad(it.key(), it.value());
+        }
+    }
+    udevBatchSize.add(udevPending.size());
+    udevPending.clear();
+
+    fillPopup();
+    devicesChanged();
+}
 #endif
 
+//read the rest of a "quoted string" whose opening quote was already read.
+//a backslash escapes the character following it.
+static bool readQuoted(QTextStream &stream, QString &str) {
+    QChar ch;
+    str.clear();
+    while (!stream.atEnd()) {
+        stream >> ch;
+        if (ch == QChar('"')) {
+            return true;
+        }
+        if (ch == QChar('\\')) {
+            if (stream.atEnd()) break;
+            stream >> ch;
+        }
+        str.append(ch);
+    }
+    return false;
+}
+
 QString LayoutManager::getFileName(const QString& layoutname ) {
     return QString("%1%2.lyt").arg(settingsDir, layoutname);
 }
@@ -180,6 +247,7 @@ bool LayoutManager::load(const QString& name) {
     //extra settings left over after things are supposed to be "cleared"
     foreach (JoyPad *joypad, joypads) {
         joypad->toDefault();
+        joypad->setBinding(QString());
     }
 
     //start reading joypads!
@@ -210,6 +278,20 @@ bool LayoutManager::load(const QString& name) {
             }
             stream.skipWhiteSpace();
             stream >> ch;
+            //optionally, the identity of the device this joystick is bound to
+            QString identity;
+            if (ch == QChar('"')) {
+                if (!readQuoted(stream, identity)) {
+                    errorBox(tr("Load error"),
+                             tr("Error reading joystick definition. Unterminated device identity."),
+                             le);
+                    if (name != currentLayout) reload();
+                    else clear();
+                    return false;
+                }
+                stream.skipWhiteSpace();
+                stream >> ch;
+            }
             if (ch != QChar('{')) {
                 errorBox(tr("Load error"),
                          tr("Error reading joystick definition. Unexpected character \"%1\". Expected '{'.").arg(ch),
@@ -221,7 +303,9 @@ bool LayoutManager::load(const QString& name) {
             int index = num - 1;
             //if there was no joypad defined for this index before, make it now!
             if (joypads[index] == 0) {
-                joypads.insert(index, new JoyPad(index, -1, this));
+                JoyPad *joypad = new JoyPad(index, -1, DeviceInfo(), this);
+                connect(joypad, &JoyPad::lost, this, &LayoutManager::joyPadLost);
+                joypads.insert(index, joypad);
             }
             //try to read the joypad, report error on fail.
             if (!joypads[index]->readConfig(stream)) {
@@ -234,6 +318,7 @@ bool LayoutManager::load(const QString& name) {
                 else clear();
                 return false;
             }
+            joypads[index]->setBinding(identity);
         }
         else if (word.startsWith('#')) {
             // ignore comment
@@ -249,6 +334,16 @@ bool LayoutManager::load(const QString& name) {
         }
     }
 
+    //the devices might have come up in another order than when this layout
+    //was saved, make them follow their bindings.
+    rebuildIdentitySlots();
+    if (rebindJoyPads()) {
+        fillPopup();
+        if (le) {
+            le->updateJoypadWidgets();
+        }
+    }
+
     //if loading succeeded, this is our new layout.
     setLayoutName(name);
     return true;
@@ -282,7 +377,9 @@ void LayoutManager::clear() {
     //reset all the joypads...
     foreach (JoyPad *joypad, joypads) {
         joypad->toDefault();
+        joypad->setBinding(QString());
     }
+    identitySlots.clear();
     //and call our layout NL
     setLayoutName(QString::null);
 }
@@ -304,6 +401,14 @@ void LayoutManager::save(const QString &filename) {
 void LayoutManager::save(QFile &file) {
     //if it's good, start writing the file
     if (file.open(QIODevice::WriteOnly)) {
+        //the layout is now bound to the devices that are plugged in.
+        foreach (JoyPad *joypad, joypads) {
+            if (joypad->isOpen()) {
+                joypad->setBinding(joypad->getDeviceInfo().identity());
+            }
+        }
+        rebuildIdentitySlots();
+
         QTextStream stream( &file );
         stream << "# " QJOYPAD_NAME " Layout File\n\n";
         foreach (JoyPad *joypad, joypads) {
@@ -580,20 +685,18 @@ void LayoutManager::fillPopup() {
     }
     m_trayMenu->addSeparator();
 
+    m_trayMenu->addAction( statsAction );
+
     //and, at the end, quit!
     m_trayMenu->addAction( quitAction );
 }
 
 void LayoutManager::updateJoyDevs() {
     debug_mesg("updating joydevs\n");
+    refreshTimer.start();
 
-    //reset all joydevs to sentinal value (-1)
-    foreach (JoyPad *joypad, joypads) {
-        joypad->close();
-    }
-
-    //clear out the list of previously available joysticks
-    available.clear();
+    //device index -> device node of every joystick device that is there now
+    QHash<int, QString> present;
 
     QRegExp devicename("/js(\\d+)$");
 
@@ -622,7 +725,7 @@ void LayoutManager::updateJoyDevs() {
 
                             if (devicename.indexIn(devpath) >= 0) {
                                 int index = devicename.cap(1).toInt();
-                                addJoyPad(index, devpath);
+                                present.insert(index, devpath);
                             }
 
                             udev_device_unref(dev);
@@ -659,20 +762,68 @@ void LayoutManager::updateJoyDevs() {
         if (devicename.indexIn(device) >= 0) {
             int index = devicename.cap(1).toInt();
             QString devpath = QString("%1/%2").arg(devdir, device);
-            addJoyPad(index, devpath);
+            present.insert(index, devpath);
         }
     }
 
 #ifdef WITH_LIBUDEV
     }
 #endif
+
+    //close the devices that went away, that stopped working or whose device
+    //node now belongs to some other device. The rest are left alone, so they
+    //keep their state and don't lose any input.
+    int closed = 0;
+    foreach (int index, available.keys()) {
+        JoyPad *joypad = available.value(index);
+        const QString devpath = present.value(index);
+        bool gone = devpath.isNull() || !joypad->isOpen() ||
+                    devpath != joypad->getDeviceInfo().path;
+        if (!gone) {
+            DeviceInfo current = DeviceInfo::peek(devpath);
+            gone = !current.name.isEmpty() &&
+                   current.identity() != joypad->getDeviceInfo().identity();
+        }
+        if (gone) {
+            removeJoyPad(index);
+            ++ closed;
+        }
+    }
+
+    //and only open the ones we don't know yet.
+    int opened = 0;
+    for (QHash<int, QString>::const_iterator it = present.constBegin(); it != present.constEnd(); ++ it) {
+        if (!available.contains(it.key()) && !probing.contains(it.key())) {
+            addJoyPad(it.key(), it.value());
+            ++ opened;
+        }
+    }
+    debug_mesg("updating joydevs: %d to open, %d closed, %d kept\n",
+               opened, closed, available.size());
+
     //when it's all done, rebuild the popup menu so it displays the correct
     //information.
     fillPopup();
+    devicesChanged();
+}
+
+void LayoutManager::devicesChanged() {
+    //the probes still underway will call this again when they're done
+    if (!probing.isEmpty()) return;
+
     if (le) {
         le->updateJoypadWidgets();
     }
-    debug_mesg("done updating joydevs\n");
+    if (refreshTimer.isValid()) {
+        refreshTime.add(refreshTimer.nsecsElapsed() / 1000);
+        debug_mesg("done updating joydevs in %lld us\n",
+                   (long long) (refreshTimer.nsecsElapsed() / 1000));
+        refreshTimer.invalidate();
+    }
+}
+
+void LayoutManager::showStats() {
+    QMessageBox::information(le, tr("Statistics - %1").arg(QJOYPAD_NAME), Stat::report());
 }
 
 void LayoutManager::addJoyPad(int index) {
@@ -681,37 +832,213 @@ void LayoutManager::addJoyPad(int index) {
 
 void LayoutManager::addJoyPad(int index, const QString& devpath) {
     debug_mesg("opening %s\n", qPrintable(devpath));
-    //try opening the device.
-    int joydev = open(qPrintable(devpath), O_RDONLY | O_NONBLOCK);
-    //if it worked, then we have a live joystick! Make sure it's properly
-    //setup.
-    if (joydev >= 0) {
-        JoyPad* joypad = joypads[index];
-        //if we've never seen this device before, make a new one!
-        if (joypad == 0) {
-            joypad = new JoyPad( index, joydev, this );
-            joypads.insert(index,joypad);
+    //try opening the device, in the background.
+    ++ probeSerial;
+    probing.insert(index, probeSerial);
+    prober->probe(index, probeSerial, devpath);
+}
+
+void LayoutManager::joyPadProbed(int index, unsigned serial, int joydev, const DeviceInfo& info, long long usec) {
+    probeTime.add(usec);
+    //the device was removed or probed again while this probe was running.
+    if (probing.value(index) != serial) {
+        ::close(joydev);
+        return;
+    }
+    probing.remove(index);
+    //we have a live joystick! Make sure it's properly setup.
+    attachJoyPad(index, joydev, info);
+    devicesChanged();
+}
+
+void LayoutManager::joyPadProbeFailed(int index, unsigned serial, const QString& devpath, int error) {
+    //failing to reopen a lost device is expected until it's back
+    bool reconnecting = false;
+    foreach (const LostDevice &dev, lost) {
+        if (dev.index == index) reconnecting = true;
+    }
+    if (!reconnecting) {
+        fprintf(stderr, "%s: %s\n", qPrintable(devpath), strerror(error));
+    }
+    if (probing.value(index) != serial) return;
+    probing.remove(index);
+    devicesChanged();
+}
+
+void LayoutManager::attachJoyPad(int index, int joydev, const DeviceInfo& info) {
+    //a device that was already open under this index got replaced.
+    if (available.contains(index)) {
+        removeJoyPad(index);
+    }
+    int slot = slotFor(index, info.identity());
+    JoyPad* joypad = joypads.value(slot);
+    //if we've never seen this device before, make a new one!
+    if (joypad == 0) {
+        joypad = new JoyPad( slot, joydev, info, this );
+        connect(joypad, &JoyPad::lost, this, &LayoutManager::joyPadLost);
+        joypads.insert(slot,joypad);
+    }
+    else {
+        debug_mesg("found previously open joypad with index %d, ignoring", index);
+        joypad->open(joydev, info);
+    }
+    //make this joystick device available.
+    available.insert(index,joypad);
+
+    //welcome back!
+    QHash<QString, LostDevice>::iterator it = lost.find(info.identity());
+    if (it != lost.end()) {
+        reconnectTime.add(it->since.elapsed());
+        debug_mesg("%s is back after %lld ms\n", qPrintable(info.identity()),
+                   (long long) it->since.elapsed());
+        lost.erase(it);
+    }
+}
+
+void LayoutManager::joyPadLost(JoyPad *joypad) {
+    deviceErrors.count();
+    const DeviceInfo &info = joypad->getDeviceInfo();
+    int index = available.key(joypad, -1);
+    if (index < 0) return;
+    available.remove(index);
+
+    LostDevice &dev = lost[info.identity()];
+    dev.index = index;
+    dev.path = info.path;
+    dev.slot = joypad->getIndex();
+    dev.attempts = 0;
+    dev.nextAttempt = RECONNECT_MIN_MSEC;
+    dev.since.start();
+    reconnectLost();
+
+    devicesChanged();
+}
+
+void LayoutManager::reconnectLost() {
+    qint64 next = -1;
+    bool gaveUp = false;
+    QHash<QString, LostDevice>::iterator it = lost.begin();
+    while (it != lost.end()) {
+        LostDevice &dev = it.value();
+        qint64 elapsed = dev.since.elapsed();
+        if (elapsed >= dev.nextAttempt && dev.attempts >= RECONNECT_ATTEMPTS) {
+            //the last attempt had its chance. The slot isn't kept for the
+            //device any longer, any other one may have it now.
+            if (!probing.contains(dev.index)) {
+                debug_mesg("giving up on %s\n", qPrintable(it.key()));
+                JoyPad *joypad = joypads.value(dev.slot);
+                if (joypad && joypad->getHealth() == JoyPad::Lost) joypad->close();
+                it = lost.erase(it);
+                gaveUp = true;
+                continue;
+            }
+            //its probe is still underway, see how that went first
+            dev.nextAttempt = elapsed + RECONNECT_MIN_MSEC;
         }
-        else {
-            debug_mesg("found previously open joypad with index %d, ignoring", index);
-            joypad->open(joydev);
+        else if (elapsed >= dev.nextAttempt) {
+            //unless udev already brought something back at that index
+            if (!available.contains(dev.index) && !probing.contains(dev.index)) {
+                addJoyPad(dev.index, dev.path);
+            }
+            ++ dev.attempts;
+            dev.nextAttempt = elapsed + qMin((qint64) RECONNECT_MIN_MSEC << dev.attempts,
+                                             (qint64) RECONNECT_MAX_MSEC);
         }
-        //make this joystick device available.
-        available.insert(index,joypad);
+        if (next < 0 || dev.nextAttempt - elapsed < next) {
+            next = dev.nextAttempt - elapsed;
+        }
+        ++ it;
     }
-    else {
-        perror(qPrintable(devpath));
+    if (next >= 0) {
+        reconnectTimer.start(next);
+    }
+    if (gaveUp) {
+        devicesChanged();
     }
 }
 
 void LayoutManager::removeJoyPad(int index) {
-    JoyPad *joypad = available[index];
+    //drop the result of a probe that might be underway
+    probing.remove(index);
+    JoyPad *joypad = available.value(index);
     if (joypad) {
         joypad->close();
         available.remove(index);
     }
 }
 
+//a slot nobody is using, no other device is bound to and no lost device is
+//waiting to get back
+static bool isFreeSlot(const JoyPad *joypad) {
+    return joypad == 0 || (joypad->getHealth() == JoyPad::Closed && joypad->getBinding().isEmpty());
+}
+
+int LayoutManager::slotFor(int index, const QString& identity) const {
+    //a lost device gets its old slot back
+    QHash<QString, LostDevice>::const_iterator it = lost.constFind(identity);
+    if (it != lost.constEnd()) {
+        JoyPad *joypad = joypads.value(it->slot);
+        if (joypad == 0 || !joypad->isOpen()) {
+            return it->slot;
+        }
+    }
+    //the first slot the layout binds to this device that isn't already
+    //driven by an identical one.
+    foreach (int slot, identitySlots.value(identity)) {
+        JoyPad *joypad = joypads.value(slot);
+        if (joypad == 0 || !joypad->isOpen()) {
+            return slot;
+        }
+    }
+    //unbound devices go by their index like they always did, unless that
+    //slot is bound to some other device.
+    if (isFreeSlot(joypads.value(index))) {
+        return index;
+    }
+    int slot = 0;
+    while (!isFreeSlot(joypads.value(slot))) {
+        ++ slot;
+    }
+    return slot;
+}
+
+void LayoutManager::rebuildIdentitySlots() {
+    identitySlots.clear();
+    for (QHash<int, JoyPad*>::const_iterator it = joypads.constBegin(); it != joypads.constEnd(); ++ it) {
+        if (it.value() && !it.value()->getBinding().isEmpty()) {
+            identitySlots[it.value()->getBinding()].append(it.key());
+        }
+    }
+    for (QHash<QString, QList<int> >::iterator it = identitySlots.begin(); it != identitySlots.end(); ++ it) {
+        std::sort(it.value().begin(), it.value().end());
+    }
+}
+
+bool LayoutManager::rebindJoyPads() {
+    QHash<int, JoyPad*> previous = available;
+    QHash<int, int> devs;
+    for (QHash<int, JoyPad*>::const_iterator it = previous.constBegin(); it != previous.constEnd(); ++ it) {
+        devs.insert(it.key(), it.value()->detach());
+    }
+    available.clear();
+
+    //bound devices first, so unbound ones can't take their slots.
+    for (int pass = 0; pass < 2; ++ pass) {
+        for (QHash<int, JoyPad*>::const_iterator it = previous.constBegin(); it != previous.constEnd(); ++ it) {
+            const DeviceInfo info = it.value()->getDeviceInfo();
+            if (identitySlots.contains(info.identity()) != (pass == 0)) continue;
+            attachJoyPad(it.key(), devs.value(it.key()), info);
+        }
+    }
+
+    for (QHash<int, JoyPad*>::const_iterator it = previous.constBegin(); it != previous.constEnd(); ++ it) {
+        if (available.value(it.key()) != it.value()) {
+            return true;
+        }
+    }
+    return false;
+}
+
 namespace SettingName {
     const char currentLayout[] = "currentLayout";
     const char groupName[] = "QJoyPad";
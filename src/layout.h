@@ -15,6 +15,8 @@
 #include <QPointer>
 #include <QInputDialog>
 #include <QSystemTrayIcon>
+#include <QTimer>
+#include <QElapsedTimer>
 
 #include "config.h"
 
@@ -30,6 +32,7 @@
 //So we can know if there is a graphical version of the Layout Manager displayed
 #include "layout_edit.h"
 
+#include "deviceprober.h"
 #include "setting.hpp"
 #include "trayicon.hpp"
 
@@ -77,10 +80,19 @@ public slots:
 		void fillPopup();
 		//update the list of available joystick devices
 		void updateJoyDevs();
+		//show what the statistics (see stats.h) have measured so far
+		void showStats();
 
     private slots:
         //when the user selects an item on the tray's popup menu
         void layoutTriggered();
+        //merge the result of a background probe (see DeviceProber)
+        void joyPadProbed(int index, unsigned serial, int joydev, const DeviceInfo& info, long long usec);
+        void joyPadProbeFailed(int index, unsigned serial, const QString& devpath, int error);
+        //a device failed, try to get it back
+        void joyPadLost(JoyPad *joypad);
+        //try to reopen the lost devices that are due
+        void reconnectLost();
     void updateTrayIcon();
     void setSetting( Setting::Enum e, bool value );
 
@@ -88,8 +100,21 @@ private:
     void settingsLoad();
     void settingsSave() const;
         void addJoyPad(int index);
+        //open and probe the device in the background, it is attached once
+        //that is done.
         void addJoyPad(int index, const QString& devpath);
+        //hand an opened and probed device to the joypad slot it belongs to
+        void attachJoyPad(int index, int joydev, const DeviceInfo& info);
         void removeJoyPad(int index);
+        //the layout slot a device with the given index and identity drives
+        int slotFor(int index, const QString& identity) const;
+        //recompute identitySlots from the bindings of the joypads
+        void rebuildIdentitySlots();
+        //move every available device into the slot it is bound to. returns
+        //true if any device changed its slot.
+        bool rebindJoyPads();
+        //update whatever shows the devices, once no more probes are underway
+        void devicesChanged();
 		//change to the given layout name and make all the necesary adjustments
         void setLayoutName(const QString& name);
 		//get the file name for a layout name
@@ -107,6 +132,7 @@ private:
         QActionGroup *layoutGroup;
         QAction *updateDevicesAction;
         QAction *updateLayoutsAction;
+        QAction *statsAction;
         QAction *quitAction;
 
         bool m_showMenuBar;
@@ -118,16 +144,48 @@ private:
 		//if there is a LayoutEdit open, this points to it. Otherwise, NULL.	
         QPointer<LayoutEdit> le;
 
+        //available is keyed by device index (jsN), joypads by layout slot
         QHash<int, JoyPad*> available;
         QHash<int, JoyPad*> joypads;
+        //device identity -> layout slots bound to it, lowest slot first.
+        //Built whenever a layout is loaded or saved so that a hot-plugged
+        //device finds its slot with a single lookup.
+        QHash<QString, QList<int> > identitySlots;
+
+        DeviceProber *prober;
+        //device index -> serial of the probe underway for it. A result with
+        //another serial is stale, its device got removed or probed again.
+        QHash<int, unsigned> probing;
+        unsigned probeSerial;
+        //runs from the start of updateJoyDevs until its probes are done
+        QElapsedTimer refreshTimer;
+
+        //a device that failed and that we're trying to get back
+        struct LostDevice {
+            int index;          //device index it had
+            QString path;       //device node it had
+            int slot;           //the slot it drove, it gets it back
+            int attempts;       //reopen attempts so far
+            qint64 nextAttempt; //msecs after since
+            QElapsedTimer since;
+        };
+        //device identity -> lost device
+        QHash<QString, LostDevice> lost;
+        QTimer reconnectTimer;
 
 #ifdef WITH_LIBUDEV
         bool initUDev();
         QSocketNotifier *udevNotifier;
         struct udev *udev;
         struct udev_monitor *monitor;
+        //device index -> device node of the devices that got added or
+        //changed since the last batch, a null string for removed ones.
+        QHash<int, QString> udevPending;
+        QTimer udevBatchTimer;
     private slots:
         void udevUpdate();
+        //apply everything udev told us during the last UDEV_BATCH_MSEC
+        void applyUdevBatch();
 #endif
 signals:
     void quit();
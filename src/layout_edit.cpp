@@ -95,6 +95,8 @@ LayoutEdit::LayoutEdit( LayoutManager* l ) :
     connect( m_actionClear, &QAction::triggered, this, &LayoutEdit::clearTopPadLayout );
     m_actionQuickSet = new QAction( QIcon::fromTheme( "tools-wizard" ), tr( "Quick set" ) );
     connect( m_actionQuickSet, &QAction::triggered, this, &LayoutEdit::wizardTopPadLayout );
+    m_actionCalibrate = new QAction( QIcon::fromTheme( "measure" ), tr( "Calibrate" ) );
+    connect( m_actionCalibrate, &QAction::triggered, this, &LayoutEdit::calibrateTopPadLayout );
     m_actionRevert = new QAction( QIcon::fromTheme( "document-revert" ), tr( "Revert changes" ) );
     connect( m_actionRevert, &QAction::triggered, lm, &LayoutManager::reload );
 
@@ -130,6 +132,7 @@ LayoutEdit::LayoutEdit( LayoutManager* l ) :
     menu->addSeparator();
     menu->addAction( m_actionClear );
     menu->addAction( m_actionQuickSet );
+    menu->addAction( m_actionCalibrate );
     menu->addAction( m_actionRevert );
     menu = menuBar->addMenu( tr( "View" ) );
     menu->addAction( m_actionUseThemeTrayIcon );
@@ -148,6 +151,7 @@ LayoutEdit::LayoutEdit( LayoutManager* l ) :
     m_toolBar->addSeparator();
     m_toolBar->addAction( m_actionClear );
     m_toolBar->addAction( m_actionQuickSet );
+    m_toolBar->addAction( m_actionCalibrate );
     m_toolBar->addAction( m_actionRevert );
 
     // setting window shortcuts, the action can be triggered only
@@ -261,6 +265,15 @@ void LayoutEdit::wizardTopPadLayout()
     widgetPtr->setAll();
 }
 
+void LayoutEdit::calibrateTopPadLayout()
+{
+    QPointer<JoyPadWidget> widgetPtr = qobject_cast<JoyPadWidget*>( padStack->currentWidget() );
+    if ( !widgetPtr ) {
+        return;
+    }
+    widgetPtr->calibrate();
+}
+
 // for a case of current layout being [NO LAYOUT]
 void LayoutEdit::enableCertainActions( bool b )
 {
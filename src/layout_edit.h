@@ -43,6 +43,8 @@ private slots:
     void clearTopPadLayout();
     // casts a magic spell on layout of pad settings of top widget stack;
     void wizardTopPadLayout();
+    // measures idle noise of the pad of top widget stack
+    void calibrateTopPadLayout();
 
     // some actions should be disabled on [NO LAYOUT] combobox
     void enableCertainActions( bool );
@@ -75,6 +77,7 @@ protected:
     // ----
     QActionPtr m_actionClear;
     QActionPtr m_actionQuickSet;
+    QActionPtr m_actionCalibrate;
     QActionPtr m_actionRevert;
     // ----
     QActionPtr m_actionUseThemeTrayIcon;
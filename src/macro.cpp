@@ -0,0 +1,256 @@
+#include <stdlib.h>
+
+#include "macro.h"
+#include "constant.h"
+#include "stats.h"
+#include "keymap.h"
+
+static Stat macroRuns("Macro runs");
+static Stat macroError("Macro inter-event error", " us");
+
+//keep track of the keys and mouse buttons e leaves pressed
+static void track( QVector<FakeEvent> &down, const FakeEvent &e ) {
+    switch (e.type) {
+    case FakeEvent::KeyDown:
+    case FakeEvent::MouseDown:
+        down.append(e);
+        break;
+    case FakeEvent::KeyUp:
+    case FakeEvent::MouseUp:
+        for (int i = 0; i < down.size(); ++ i) {
+            if (down[i].keycode == e.keycode &&
+                (down[i].type == FakeEvent::MouseDown) == (e.type == FakeEvent::MouseUp)) {
+                down.remove(i);
+                break;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+//the event that lets go of what a press pressed
+static FakeEvent releaseOf( const FakeEvent &press ) {
+    FakeEvent e = press;
+    e.type = (e.type == FakeEvent::MouseDown) ? FakeEvent::MouseUp : FakeEvent::KeyUp;
+    return e;
+}
+
+Macro::Macro()
+    : repeat(false), cancel(false), length(0), running(false), held(false),
+      runStart(0), next(0), run(0), lastDue(0), lastSent(-1) {}
+
+Macro::~Macro() {
+    stop();
+}
+
+bool Macro::read( QStringList::Iterator &it, const QStringList::Iterator &end ) {
+    stop();
+    steps.clear();
+    bool ok;
+    int val;
+    qint64 at = 0;
+    while (++it != end && *it != "end") {
+        Step step;
+        step.at = at;
+        if (*it == "wait") {
+            ++it;
+            if (it == end) return false;
+            val = (*it).toInt(&ok);
+            if (!ok || val < 0 || val > MAXMACROWAIT) return false;
+            at += (qint64) val * 1000;
+            continue;
+        }
+        else if (*it == "move") {
+            step.event.type = FakeEvent::MouseMove;
+            ++it;
+            if (it == end) return false;
+            step.event.move.x = (*it).toInt(&ok);
+            if (!ok || abs(step.event.move.x) > MAXMOUSESPEED) return false;
+            ++it;
+            if (it == end) return false;
+            step.event.move.y = (*it).toInt(&ok);
+            if (!ok || abs(step.event.move.y) > MAXMOUSESPEED) return false;
+        }
+        else {
+            if (*it == "keydown") step.event.type = FakeEvent::KeyDown;
+            else if (*it == "keyup") step.event.type = FakeEvent::KeyUp;
+            else if (*it == "mousedown") step.event.type = FakeEvent::MouseDown;
+            else if (*it == "mouseup") step.event.type = FakeEvent::MouseUp;
+            else return false;
+            ++it;
+            if (it == end) return false;
+            if (step.event.type == FakeEvent::KeyDown || step.event.type == FakeEvent::KeyUp) {
+                if (!readkey(*it, step.event.keycode)) return false;
+            }
+            else {
+                val = (*it).toInt(&ok);
+                if (!ok || val < 0 || val > MAXKEY) return false;
+                step.event.keycode = val;
+            }
+        }
+        if (steps.size() >= MAXMACROSTEPS) return false;
+        steps.append(step);
+    }
+    if (it == end) return false;
+    length = at;
+    return true;
+}
+
+void Macro::write( QTextStream &stream ) const {
+    stream << "macro";
+    qint64 at = 0;
+    foreach (const Step& step, steps) {
+        if (step.at != at) stream << " wait " << (step.at - at) / 1000;
+        at = step.at;
+        switch (step.event.type) {
+        case FakeEvent::MouseMove:
+            stream << " move " << step.event.move.x << " " << step.event.move.y;
+            break;
+        case FakeEvent::KeyDown:
+            stream << " keyDown " << writekey(step.event.keycode);
+            break;
+        case FakeEvent::KeyUp:
+            stream << " keyUp " << writekey(step.event.keycode);
+            break;
+        case FakeEvent::MouseDown:
+            stream << " mouseDown " << step.event.keycode;
+            break;
+        case FakeEvent::MouseUp:
+            stream << " mouseUp " << step.event.keycode;
+            break;
+        }
+    }
+    if (length != at) stream << " wait " << (length - at) / 1000;
+    stream << " end";
+}
+
+void Macro::clear() {
+    stop();
+    steps.clear();
+    length = 0;
+    repeat = false;
+    cancel = false;
+}
+
+void Macro::start() {
+    if (steps.isEmpty()) return;
+    //a run that is still going on is cut short
+    releaseHeld();
+    held = true;
+    running = true;
+    runStart = Scheduler::now();
+    next = 0;
+    run = 0;
+    lastSent = -1;
+    macroRuns.count();
+    timeout(runStart);
+}
+
+void Macro::letGo() {
+    held = false;
+    if (cancel) stop();
+}
+
+void Macro::stop() {
+    Scheduler::instance()->cancel(this);
+    running = false;
+    held = false;
+    releaseHeld();
+}
+
+void Macro::timeout( qint64 ) {
+    if (!running) return;
+    for (;;) {
+        const qint64 now = Scheduler::now();
+        if (next == 0 && run > 0) {
+            //the keys of the last run are let go of only when the next one
+            //starts, so a trailing wait keeps them held as written
+            releaseHeld();
+            //the button was let go of while waiting for this run
+            if (!held) {
+                running = false;
+                return;
+            }
+        }
+        //a whole run that can't be cancelled can be timed by the X server
+        if (next == 0 && !cancel && sendRun(now)) {
+            next = steps.size();
+        }
+        //everything that is due by now goes out at once
+        while (next < steps.size() && runStart + steps[next].at <= now) {
+            send(steps[next], runStart + steps[next].at);
+            ++ next;
+        }
+        if (next < steps.size()) {
+            Scheduler::instance()->schedule(this, runStart + steps[next].at);
+            return;
+        }
+        //the end of a run
+        if (!repeat || !held) break;
+        //the next run starts exactly when this one was meant to end
+        runStart += qMax(length, (qint64) MINMACROPERIOD);
+        //fallen a whole run behind: don't try to catch up
+        if (runStart < now) runStart = now;
+        next = 0;
+        ++ run;
+        macroRuns.count();
+        if (runStart > now) {
+            Scheduler::instance()->schedule(this, runStart);
+            return;
+        }
+    }
+    running = false;
+    releaseHeld();
+}
+
+void Macro::send( const Step& step, qint64 due ) {
+    //how far the time between two events is off from what it should be
+    const qint64 now = Scheduler::now();
+    if (lastSent >= 0) {
+        macroError.add(llabs((now - lastSent) - (due - lastDue)));
+    }
+    lastSent = now;
+    lastDue = due;
+
+    track(down, step.event);
+    sendevent(step.event);
+}
+
+bool Macro::sendRun( qint64 now ) {
+    if (!serverTiming()) return false;
+    QVector<FakeEvent> events;
+    QVector<int> delays;
+    QVector<FakeEvent> held;
+    //every event is timed from now, so the rounding to whole milliseconds
+    //doesn't add up
+    int last = 0;
+    foreach (const Step& step, steps) {
+        const int at = (int) ((qMax(runStart + step.at - now, (qint64) 0) + 500) / 1000);
+        events.append(step.event);
+        delays.append(at - last);
+        last = at;
+        track(held, step.event);
+    }
+    //what's left pressed is let go of when the next run would start, or
+    //right after the last step if there is none
+    int release = 0;
+    if (repeat) {
+        release = qMax((int) ((qMax(runStart + length - now, (qint64) 0) + 500) / 1000) - last, 0);
+    }
+    for (int i = held.size() - 1; i >= 0; -- i) {
+        events.append(releaseOf(held[i]));
+        delays.append(i == held.size() - 1 ? release : 0);
+    }
+    return sendsequence(events.constData(), delays.constData(), events.size());
+}
+
+void Macro::releaseHeld() {
+    //whatever a macro presses, it lets go of when it is done, in reverse
+    while (!down.isEmpty()) {
+        const FakeEvent e = releaseOf(down.last());
+        down.pop_back();
+        sendevent(e);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef QJOYPAD_MACRO_H
+#define QJOYPAD_MACRO_H
+
+#include <QTextStream>
+#include <QStringList>
+#include <QVector>
+
+//the events a macro sends
+#include "event.h"
+//for the deadlines of the steps
+#include "scheduler.h"
+
+//a macro can't be longer than this many events, and no single wait longer
+//than this (msec)
+#define MAXMACROSTEPS 256
+#define MAXMACROWAIT 10000
+//a macro that repeats takes at least this long per run (usec), however
+//short it is written
+#define MINMACROPERIOD 1000
+
+//a sequence of key/mouse events with waits in between, as in "press A, wait
+//16 ms, press B, release both". Every step has its deadline relative to the
+//start of the run, so the waits don't add up the lateness of the steps
+//before them.
+class Macro : public Timed {
+	public:
+		Macro();
+		~Macro();
+		//read the steps that follow the word "macro", up to and including
+		//the word "end". it is left on "end".
+		bool read( QStringList::Iterator &it, const QStringList::Iterator &end );
+		//write the steps as read() expects them, starting with "macro"
+		void write( QTextStream &stream ) const;
+		void clear();
+		bool isEmpty() const { return steps.isEmpty(); }
+		bool isRunning() const { return running; }
+		//start a run (over), the first steps are sent right away
+		void start();
+		//the button was let go of: don't start another run
+		void letGo();
+		//stop right now, letting go of whatever the macro holds down
+		void stop();
+		//send the steps that are due and wait for the next one
+		void timeout( qint64 due );
+		//run again and again while the button is held
+		bool repeat;
+		//stop as soon as the button is let go of, instead of finishing the run
+		bool cancel;
+	private:
+		struct Step {
+			//how long after the start of the run this is sent, usec
+			qint64 at;
+			FakeEvent event;
+		};
+		void send( const Step& step, qint64 due );
+		//hand the whole run over to the X server to time, if it can
+		bool sendRun( qint64 now );
+		void releaseHeld();
+		QVector<Step> steps;
+		//how long a run takes, including waits after the last step
+		qint64 length;
+		bool running;
+		bool held;
+		qint64 runStart;
+		//the step to send next, and how many runs came before this one
+		int next;
+		int run;
+		//the keys and mouse buttons the macro pressed and didn't release yet
+		QVector<FakeEvent> down;
+		//when the last step was due and when it was really sent
+		qint64 lastDue;
+		qint64 lastSent;
+};
+
+#endif
@@ -1,5 +1,7 @@
 //for ouput when there is no GUI going
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 //to create and handle signals for various events
 #include <signal.h>
@@ -11,11 +13,18 @@
 #include <QPointer>
 #include <QFileInfo>
 #include <QTranslator>
+#include <QX11Info>
 
 //to load layouts
 #include "layout.h"
 //to give event.h the current X11 display
 #include "event.h"
+//to send them somewhere else
+#include "sinks.h"
+//to keep the keysyms of layouts on the right keycodes
+#include "keymap.h"
+//to run a layout on recorded joystick events
+#include "replay.h"
 //to produce errors!
 #include "error.h"
 #include "config.h"
@@ -103,6 +112,19 @@ PidFile::~PidFile()
 
 int main( int argc, char **argv )
 {
+    //a replay or a dump needs no X server, and without one Qt has to be
+    //told not to look for it
+    if (!getenv("DISPLAY") && !getenv("QT_QPA_PLATFORM")) {
+        for (int i = 1; i < argc; ++ i) {
+            if (strncmp(argv[i], "--replay", 8) == 0 || strncmp(argv[i], "--dump-", 7) == 0 ||
+                strncmp(argv[i], "-p", 2) == 0 || strncmp(argv[i], "-r", 2) == 0 ||
+                strncmp(argv[i], "-e", 2) == 0) {
+                setenv("QT_QPA_PLATFORM", "offscreen", 1);
+                break;
+            }
+        }
+    }
+
     //create a new event loop. This will be captured by the QApplication
     //when it gets created
     QApplication app( argc, argv );
@@ -141,6 +163,16 @@ int main( int argc, char **argv )
     //this execution wasn't made to update the joystick device list.
     bool update = false;
     bool forceTrayIcon = false;
+    //send events through XCB instead of Xlib
+    bool useXcb = false;
+    //how many events to benchmark the output with, 0 for none
+    int benchmark = 0;
+    //where events go, 0 for the X server
+    OutputSink *sink = 0;
+    //the sinks that have to be deleted at the end
+    QList<OutputSink*> sinks;
+    //joystick events to run the layout on instead of a device
+    QString replayFile;
 
     //parse command-line options
     struct option long_options[] = {
@@ -149,11 +181,19 @@ int main( int argc, char **argv )
         {"force-tray", no_argument,       0, 't'},
         {"notray",     no_argument,       0, 'T'},
         {"update",     no_argument,       0, 'u'},
+        {"server-timing", no_argument,    0, 's'},
+        {"flush-window", required_argument, 0, 'w'},
+        {"xcb",        no_argument,       0, 'x'},
+        {"benchmark-output", required_argument, 0, 'b'},
+        {"output",     required_argument, 0, 'o'},
+        {"dump-recording", required_argument, 0, 'r'},
+        {"dump-events", required_argument, 0, 'e'},
+        {"replay",     required_argument, 0, 'p'},
         {0,            0,                 0,  0 }
     };
 
     for (;;) {
-        int c = getopt_long(argc, argv, "hd:tTu", long_options, NULL);
+        int c = getopt_long(argc, argv, "hd:tTusw:xb:o:r:e:p:", long_options, NULL);
 
         if (c == -1)
             break;
@@ -161,7 +201,7 @@ int main( int argc, char **argv )
         switch (c) {
             case 'h':
                 printf("%s", qPrintable(app.translate("main","%1\n"
-                    "Usage: %2 [--device=\"/device/path\"] [--notray|--force-tray] [\"layout name\"]\n"
+                    "Usage: %2 [--device=\"/device/path\"] [--notray|--force-tray] [--server-timing] [--flush-window=MSEC] [--xcb] [--benchmark-output=N] [--output=SINK] [--dump-recording=FILE] [--dump-events=FILE] [--replay=FILE] [\"layout name\"]\n"
                     "\n"
                     "Options:\n"
                     "  -h, --help            Print this help message.\n"
@@ -173,6 +213,26 @@ int main( int argc, char **argv )
                     "                        window managers that don't support this feature.\n"
                     "  -u, --update          Force a running instance of QJoyPad to update its\n"
                     "                        list of devices and layouts.\n"
+                    "  -s, --server-timing   Let the X server time the releases of rapid fire\n"
+                    "                        and gradient pulses and whole macros, so QJoyPad\n"
+                    "                        wakes up and flushes less often.\n"
+                    "  -w, --flush-window=MSEC  Let key and mouse events wait up to MSEC\n"
+                    "                        milliseconds (at most 100) to be sent to the X\n"
+                    "                        server together with later ones.\n"
+                    "  -x, --xcb             Send key and mouse events through an XCB connection\n"
+                    "                        of their own (if QJoyPad was built WITH_XCB).\n"
+                    "  -b, --benchmark-output=N  Move the mouse by a pixel and back N times,\n"
+                    "                        print how long the X server takes for each\n"
+                    "                        with and without GUI traffic, and quit.\n"
+                    "  -o, --output=SINK     Where key and mouse events go: \"xtest\" (the X\n"
+                    "                        server, the default), \"null\" (nowhere),\n"
+                    "                        \"record:FILE\" (recorded to FILE) or \"tee:FILE\"\n"
+                    "                        (the X server, and recorded to FILE).\n"
+                    "  -r, --dump-recording=FILE  Print the events recorded in FILE, and quit.\n"
+                    "  -e, --dump-events=FILE  The same, without the times.\n"
+                    "  -p, --replay=FILE     Run the given layout on the joystick events in FILE\n"
+                    "                        (as read from a device, e.g. /dev/input/js0) instead\n"
+                    "                        of on joystick 1, without the GUI, and quit.\n"
                     "  \"layout name\"         Load the given layout in an already running\n"
                     "                        instance of QJoyPad, or start QJoyPad using the\n"
                     "                        given layout.\n").arg(QJOYPAD_NAME, argc > 0 ? argv[0] : "qjoypad")));
@@ -202,6 +262,91 @@ int main( int argc, char **argv )
                 update = true;
                 break;
 
+            case 's':
+                setServerTiming(true);
+                break;
+
+            case 'x':
+                useXcb = true;
+                break;
+
+            case 'b': {
+                bool ok = false;
+                benchmark = QString(optarg).toInt(&ok);
+                if (!ok || benchmark < 1) {
+                    fprintf(stderr, "%s", qPrintable(app.translate("main",
+                        "Not a number of events: %1\n").arg(optarg)));
+                    return EXIT_CODE_ILLEGAL_ARGUMENT;
+                }
+                break;
+            }
+
+            case 'o': {
+                const QString arg = optarg;
+                RecordingSink *recording = 0;
+                if (arg.startsWith("record:") || arg.startsWith("tee:")) {
+                    recording = new RecordingSink(arg.section(':', 1));
+                    if (!recording->isOpen()) {
+                        delete recording;
+                        fprintf(stderr, "%s", qPrintable(app.translate("main",
+                            "Can't write a recording to: %1\n").arg(arg.section(':', 1))));
+                        return EXIT_CODE_ILLEGAL_ARGUMENT;
+                    }
+                }
+                qDeleteAll(sinks);
+                sinks.clear();
+                if (arg == "xtest") {
+                    sink = 0;
+                }
+                else if (arg == "null") {
+                    sink = new NullSink();
+                    sinks.append(sink);
+                }
+                else if (arg.startsWith("record:")) {
+                    sink = recording;
+                    sinks.append(sink);
+                }
+                else if (arg.startsWith("tee:")) {
+                    sinks.append(recording);
+                    sink = new TeeSink(xtestOutput(), recording);
+                    sinks.append(sink);
+                }
+                else {
+                    fprintf(stderr, "%s", qPrintable(app.translate("main",
+                        "Not an output: %1\n").arg(arg)));
+                    return EXIT_CODE_ILLEGAL_ARGUMENT;
+                }
+                break;
+            }
+
+            case 'r':
+            case 'e': {
+                QTextStream out(stdout);
+                if (!RecordingSink::dump(optarg, out, c == 'r')) {
+                    out.flush();
+                    fprintf(stderr, "%s", qPrintable(app.translate("main",
+                        "Not a recording of QJoyPad: %1\n").arg(optarg)));
+                    return EXIT_CODE_ILLEGAL_ARGUMENT;
+                }
+                return 0;
+            }
+
+            case 'p':
+                replayFile = optarg;
+                break;
+
+            case 'w': {
+                bool ok = false;
+                int msec = QString(optarg).toInt(&ok);
+                if (!ok || msec < 0) {
+                    fprintf(stderr, "%s", qPrintable(app.translate("main",
+                        "Not a number of milliseconds: %1\n").arg(optarg)));
+                    return EXIT_CODE_ILLEGAL_ARGUMENT;
+                }
+                setFlushWindow(msec);
+                break;
+            }
+
             case '?':
                 fprintf(stderr, "%s", qPrintable(app.translate("main",
                     "Illeagal argument.\n"
@@ -210,6 +355,14 @@ int main( int argc, char **argv )
         }
     }
 
+    //a benchmark doesn't need anything else
+    if (benchmark > 0) {
+        openOutput();
+        benchmarkoutput(benchmark);
+        closeOutput();
+        return 0;
+    }
+
     if (optind < argc) {
         layout = argv[optind ++];
 
@@ -221,6 +374,47 @@ int main( int argc, char **argv )
         }
     }
 
+    //a replay runs on its own, next to a running instance or none
+    if (!replayFile.isEmpty()) {
+        if (layout.isEmpty()) {
+            fprintf(stderr, "%s", qPrintable(app.translate("main",
+                "A replay needs the name of a layout.\n")));
+            return EXIT_CODE_ILLEGAL_ARGUMENT;
+        }
+        //there's no one to send events to without an X server
+        if (!sink && !QX11Info::isPlatformX11()) {
+            fprintf(stderr, "%s", qPrintable(app.translate("main",
+                "Without an X server, a replay needs --output=null or --output=record:FILE.\n")));
+            return EXIT_CODE_ILLEGAL_ARGUMENT;
+        }
+        openOutput();
+        watchkeymap();
+        setOutputSink(sink);
+        int result = 0;
+        {
+            Replay replay;
+            if (!replay.loadLayout(settingsDir + layout + ".lyt")) {
+                fprintf(stderr, "%s", qPrintable(app.translate("main",
+                    "Can't read the layout: %1\n").arg(layout)));
+                result = EXIT_CODE_ILLEGAL_ARGUMENT;
+            }
+            else if (!replay.loadEvents(replayFile)) {
+                fprintf(stderr, "%s", qPrintable(app.translate("main",
+                    "Not a recording of joystick events: %1\n").arg(replayFile)));
+                result = EXIT_CODE_ILLEGAL_ARGUMENT;
+            }
+            else {
+                QObject::connect(&replay, &Replay::finished, &app, &QApplication::quit, Qt::QueuedConnection);
+                QTimer::singleShot(0, &replay, SLOT(start()));
+                app.exec();
+            }
+        }
+        closeOutput();
+        setOutputSink(0);
+        qDeleteAll(sinks);
+        return result;
+    }
+
     //if the user specified a layout to use,
     if (!layout.isEmpty())
     {
@@ -279,6 +473,15 @@ int main( int argc, char **argv )
 
     //create a new LayoutManager with a tray icon / floating icon, depending
     //on the user's request
+    //the output has an X connection of its own
+    openOutput();
+    watchkeymap();
+    setOutputSink(sink);
+    if (useXcb && !setOutputBackend(XcbBackend)) {
+        fprintf(stderr, "%s", qPrintable(app.translate("main",
+            "Can't send events through XCB, using Xlib instead.\n")));
+    }
+
     layoutManagerPtr = new LayoutManager( useTrayIcon, devdir, settingsDir );
     QObject::connect( layoutManagerPtr, &LayoutManager::quit, &app, &QApplication::quit );
 
@@ -286,5 +489,9 @@ int main( int argc, char **argv )
     signal( SIGUSR1, catchSIGUSR1 );
     signal( SIGUSR2, catchSIGUSR2 );
 
-    return app.exec();
+    const int result = app.exec();
+    closeOutput();
+    setOutputSink(0);
+    qDeleteAll(sinks);
+    return result;
 }
@@ -0,0 +1,94 @@
+#include <string.h>
+
+#include <QFile>
+#include <QTextStream>
+
+#include "replay.h"
+#include "event.h"
+#include "error.h"
+
+Replay::Replay( QObject *parent ) : QObject(parent), at(0) {
+    timer.setSingleShot(true);
+    timer.setTimerType(Qt::PreciseTimer);
+    connect(&timer, SIGNAL(timeout()), this, SLOT(next()));
+}
+
+Replay::~Replay() {
+    foreach (JoyPad *joypad, joypads) {
+        joypad->release();
+    }
+    qDeleteAll(joypads);
+    flushevents();
+}
+
+bool Replay::loadLayout( const QString &path ) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    QTextStream stream(&file);
+    //like LayoutManager::load(), without the device identities
+    QString word;
+    while (!stream.atEnd()) {
+        stream >> word;
+        if (word.isNull()) break;
+        if (word.startsWith('#')) {
+            stream.readLine();
+            continue;
+        }
+        if (word.compare(QLatin1String("joystick"), Qt::CaseInsensitive) != 0) return false;
+        int num = 0;
+        stream >> num;
+        if (num < 1) return false;
+        //skip the device identity, if any
+        QChar ch;
+        do {
+            stream >> ch;
+        } while (ch != QChar('{') && !stream.atEnd());
+        if (ch != QChar('{')) return false;
+        JoyPad *&joypad = joypads[num - 1];
+        if (!joypad) joypad = new JoyPad(num - 1, -1, DeviceInfo(), this);
+        if (!joypad->readConfig(stream)) return false;
+    }
+    return joypads.contains(0);
+}
+
+bool Replay::loadEvents( const QString &path ) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    const QByteArray data = file.readAll();
+    if (data.size() % sizeof(js_event) != 0) return false;
+    events.resize(data.size() / sizeof(js_event));
+    memcpy(events.data(), data.constData(), data.size());
+    return true;
+}
+
+void Replay::start() {
+    at = 0;
+    //a recording starts with the state the device was in, like it does
+    //after opening it
+    foreach (JoyPad *joypad, joypads) {
+        joypad->startSync();
+    }
+    next();
+}
+
+void Replay::next() {
+    JoyPad *joypad = joypads.value(0);
+    if (at >= events.size() || !joypad) {
+        emit finished();
+        return;
+    }
+    //everything that was read from the device at once goes in at once,
+    //like in JoyPad::handleJoyEvents()
+    const quint32 time = events[at].time;
+    while (at < events.size() && events[at].time == time) {
+        joypad->jsevent(events[at]);
+        ++ at;
+    }
+    endbatch();
+    if (at < events.size()) {
+        timer.start(events[at].time - time);
+    }
+    else {
+        timer.start(REPLAYTAIL);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef QJOYPAD_REPLAY_H
+#define QJOYPAD_REPLAY_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QTimer>
+
+#include <linux/joystick.h>
+
+#include "joypad.h"
+
+//how long the replay goes on after the last event (msec), so rapid fire,
+//macros and the like get to finish
+#define REPLAYTAIL 1000
+
+//runs a layout on joystick events recorded from a device (for example with
+//"cat /dev/input/js0 > FILE") instead of on the device itself, without the
+//GUI and without an X server to read from. The events are fed in with the
+//same time between them as they were recorded with, so with a recording
+//output sink, the same input gives the same output every time.
+class Replay : public QObject {
+	Q_OBJECT
+	public:
+		Replay( QObject *parent = 0 );
+		~Replay();
+		//read the joystick sections of a layout file
+		bool loadLayout( const QString &path );
+		//read the events of a recording
+		bool loadEvents( const QString &path );
+	public slots:
+		//feed the events into joystick 1 of the layout
+		void start();
+	signals:
+		void finished();
+	private slots:
+		void next();
+	private:
+		QHash<int, JoyPad*> joypads;
+		QVector<js_event> events;
+		int at;
+		QTimer timer;
+};
+
+#endif
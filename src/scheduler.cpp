@@ -0,0 +1,89 @@
+#include <QElapsedTimer>
+
+#include "scheduler.h"
+#include "stats.h"
+//to flush the events of a batch of deadlines at once
+#include "event.h"
+
+static Stat lateness("Scheduler lateness", " us");
+
+Scheduler *Scheduler::instance() {
+    //lives as long as the process, like the LayoutManager that uses it
+    static Scheduler *scheduler = 0;
+    if (!scheduler) scheduler = new Scheduler();
+    return scheduler;
+}
+
+qint64 Scheduler::now() {
+    static QElapsedTimer clock;
+    if (!clock.isValid()) clock.start();
+    return clock.nsecsElapsed() / 1000;
+}
+
+qint64 Scheduler::fromEventTime( quint32 msec ) {
+    static qint64 offset = 0;
+    static bool hasOffset = false;
+    const qint64 candidate = now() - (qint64) msec * 1000;
+    //a jump by more than a second means the kernel clock wrapped around
+    //(every 49 days) or the machine was suspended; start over then.
+    if (!hasOffset || candidate < offset || candidate - offset > 1000000) {
+        offset = candidate;
+        hasOffset = true;
+    }
+    return (qint64) msec * 1000 + offset;
+}
+
+Scheduler::Scheduler() {
+    timer.setSingleShot(true);
+    timer.setTimerType(Qt::PreciseTimer);
+    connect(&timer, SIGNAL(timeout()), this, SLOT(fire()));
+}
+
+void Scheduler::schedule( Timed *who, qint64 due ) {
+    QHash<Timed*, qint64>::iterator it = deadlines.find(who);
+    if (it != deadlines.end()) {
+        queue.remove(it.value(), who);
+        it.value() = due;
+    }
+    else {
+        deadlines.insert(who, due);
+    }
+    queue.insert(due, who);
+    rearm();
+}
+
+void Scheduler::cancel( Timed *who ) {
+    QHash<Timed*, qint64>::iterator it = deadlines.find(who);
+    if (it == deadlines.end()) return;
+    queue.remove(it.value(), who);
+    deadlines.erase(it);
+    rearm();
+}
+
+void Scheduler::fire() {
+    //whatever is due now, in order. A Timed may schedule itself (or others)
+    //again from timeout(), so always look at the queue afresh.
+    while (!queue.isEmpty()) {
+        QMultiMap<qint64, Timed*>::iterator first = queue.begin();
+        const qint64 due = first.key();
+        const qint64 time = now();
+        if (due > time) break;
+        Timed *who = first.value();
+        queue.erase(first);
+        deadlines.remove(who);
+        lateness.add(time - due);
+        who->timeout(due);
+    }
+    endbatch();
+    rearm();
+}
+
+void Scheduler::rearm() {
+    if (queue.isEmpty()) {
+        timer.stop();
+        return;
+    }
+    //QTimer counts in milliseconds; round up so we're never early.
+    const qint64 wait = queue.begin().key() - now();
+    timer.start(wait > 0 ? (int) ((wait + 999) / 1000) : 0);
+}
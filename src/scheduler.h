@@ -0,0 +1,52 @@
+#ifndef QJOYPAD_SCHEDULER_H
+#define QJOYPAD_SCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QMultiMap>
+#include <QHash>
+
+//anything that wants to be woken up by the Scheduler
+class Timed {
+	public:
+		virtual ~Timed() {}
+		//the deadline that was scheduled has come. due is the deadline
+		//itself, not the (slightly later) time it is now, so the next one
+		//can be computed from it without drifting.
+		virtual void timeout( qint64 due ) = 0;
+};
+
+//one precise timer for all the deadlines of all axes and buttons, instead of
+//a timer per component ticking every MSEC to check if something is due.
+//Times are in microseconds of a monotonic clock, see now().
+//Every Timed has at most one deadline at a time.
+class Scheduler : public QObject {
+	Q_OBJECT
+	public:
+		static Scheduler *instance();
+		//the current time in microseconds
+		static qint64 now();
+		//turn a kernel event timestamp (js_event.time, msec) into our time.
+		//The two clocks are tied by the smallest difference seen so far,
+		//i.e. by the event that was delivered the quickest. Only pass the
+		//time of an event that just came in, never one made up from it:
+		//a time in the future would look like the quickest delivery ever.
+		//Add delays to the result instead.
+		static qint64 fromEventTime( quint32 msec );
+		//call who->timeout(due) once due has come, instead of whatever
+		//deadline who had before
+		void schedule( Timed *who, qint64 due );
+		//forget about who's deadline, if any
+		void cancel( Timed *who );
+	private slots:
+		void fire();
+	private:
+		Scheduler();
+		//wait for the earliest deadline
+		void rearm();
+		QMultiMap<qint64, Timed*> queue;
+		QHash<Timed*, qint64> deadlines;
+		QTimer timer;
+};
+
+#endif
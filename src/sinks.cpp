@@ -0,0 +1,71 @@
+#include "sinks.h"
+#include "scheduler.h"
+
+RecordingSink::RecordingSink( const QString &path )
+    : file(path), start(Scheduler::now()) {
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return;
+    stream.setDevice(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << (quint32) RECORDING_MAGIC << (quint32) RECORDING_VERSION;
+}
+
+RecordingSink::~RecordingSink() {
+    file.close();
+}
+
+void RecordingSink::send( const FakeEvent &e ) {
+    if (!file.isOpen()) return;
+    stream << (qint64) (Scheduler::now() - start) << (quint8) e.type;
+    if (e.type == FakeEvent::MouseMove) {
+        stream << (qint32) e.move.x << (qint32) e.move.y;
+    }
+    else {
+        stream << (qint32) e.keycode << (qint32) 0;
+    }
+}
+
+void RecordingSink::flush() {
+    //QFile buffers on its own, this only writes that out
+    if (file.isOpen()) file.flush();
+}
+
+bool RecordingSink::dump( const QString &path, QTextStream &out, bool times ) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (stream.status() != QDataStream::Ok || magic != RECORDING_MAGIC || version != RECORDING_VERSION) {
+        return false;
+    }
+    while (!stream.atEnd()) {
+        qint64 at;
+        quint8 type;
+        qint32 a, b;
+        stream >> at >> type >> a >> b;
+        if (stream.status() != QDataStream::Ok) return false;
+        if (times) out << at << " ";
+        switch (type) {
+        case FakeEvent::MouseMove:
+            out << "move " << a << " " << b;
+            break;
+        case FakeEvent::KeyDown:
+            out << "keyDown " << a;
+            break;
+        case FakeEvent::KeyUp:
+            out << "keyUp " << a;
+            break;
+        case FakeEvent::MouseDown:
+            out << "mouseDown " << a;
+            break;
+        case FakeEvent::MouseUp:
+            out << "mouseUp " << a;
+            break;
+        default:
+            return false;
+        }
+        out << "\n";
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef QJOYPAD_SINKS_H
+#define QJOYPAD_SINKS_H
+
+#include <QFile>
+#include <QDataStream>
+#include <QTextStream>
+
+#include "event.h"
+
+//recordings start with these, so a file that isn't one (or one of another
+//version) can be told apart
+#define RECORDING_MAGIC 0x514a5052
+#define RECORDING_VERSION 1
+
+//throws every event away, to run the mapping engine without an X server
+class NullSink : public OutputSink {
+	public:
+		void send( const FakeEvent& ) {}
+};
+
+//writes every event to a file, with when it was sent (usec after the
+//recording started). Recordings of the same input from two versions of
+//QJoyPad can be dumped and diffed.
+class RecordingSink : public OutputSink {
+	public:
+		RecordingSink( const QString &path );
+		~RecordingSink();
+		bool isOpen() const { return file.isOpen(); }
+		void send( const FakeEvent &e );
+		void flush();
+		//write a recording as text, one event per line, with or without
+		//the times (which are never quite the same twice). false if it
+		//can't be read.
+		static bool dump( const QString &path, QTextStream &out, bool times = true );
+	private:
+		QFile file;
+		QDataStream stream;
+		qint64 start;
+};
+
+//passes every event on to two sinks, like recording what goes to the X
+//server. Sequences are timed locally, so both see all of their events.
+class TeeSink : public OutputSink {
+	public:
+		TeeSink( OutputSink *first, OutputSink *second )
+			: first(first), second(second) {}
+		void send( const FakeEvent &e ) {
+			first->send(e);
+			second->send(e);
+		}
+		void flush() {
+			first->flush();
+			second->flush();
+		}
+	private:
+		OutputSink *first;
+		OutputSink *second;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include <QElapsedTimer>
+#include <QStringList>
+
+#include "stats.h"
+
+//all stats, most recently constructed first. A plain pointer is initialized
+//before any constructor runs, so static Stats in other files may register
+//themselves in whatever order they like.
+static Stat *firstStat = 0;
+
+static QElapsedTimer &uptime() {
+    static QElapsedTimer timer;
+    if (!timer.isValid()) timer.start();
+    return timer;
+}
+
+Stat::Stat( const char *name, const char *unit )
+    : name(name), unit(unit), events(0), samples(0), sum(0), last(0), min(0), max(0), next(firstStat) {
+    firstStat = this;
+    uptime();
+}
+
+void Stat::add( long long value ) {
+    ++ events;
+    if (samples == 0 || value < min) min = value;
+    if (samples == 0 || value > max) max = value;
+    ++ samples;
+    sum += value;
+    last = value;
+}
+
+QString Stat::report() {
+    const double seconds = uptime().elapsed() / 1000.0;
+    QStringList lines;
+    for (const Stat *stat = firstStat; stat; stat = stat->next) {
+        QString line = QString("%1: %2 (%3/s)")
+                .arg(stat->name)
+                .arg(stat->events)
+                .arg(seconds > 0 ? stat->events / seconds : 0.0, 0, 'f', 1);
+        if (stat->samples > 0) {
+            line += QString(", last %1%5, min %2%5, avg %3%5, max %4%5")
+                    .arg(stat->last)
+                    .arg(stat->min)
+                    .arg(stat->sum / stat->samples)
+                    .arg(stat->max)
+                    .arg(stat->unit);
+        }
+        lines.prepend(line);
+    }
+    return lines.join("\n");
+}
@@ -0,0 +1,34 @@
+#ifndef QJOYPAD_STATS_H
+#define QJOYPAD_STATS_H
+
+#include <QString>
+
+//a named running statistic: how often something happened and, optionally,
+//the last/min/average/max of a value measured each time (usually a duration
+//in microseconds). Stats are meant to be static objects right next to the
+//code they measure; recording is a few integer operations and no lookups.
+//Stat::report() lists all of them, it is shown from the tray menu.
+//Stats are not thread safe, only record from the GUI thread.
+class Stat {
+	public:
+		Stat( const char *name, const char *unit = "" );
+		//count an occurrence that has no value
+		void count( long long n = 1 ) { events += n; }
+		//count an occurrence and record its value
+		void add( long long value );
+		long long total() const { return events; }
+		//a human readable summary of all stats
+		static QString report();
+	private:
+		const char *name;
+		const char *unit;
+		long long events;
+		long long samples;
+		long long sum;
+		long long last;
+		long long min;
+		long long max;
+		Stat *next;
+};
+
+#endif
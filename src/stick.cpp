@@ -0,0 +1,181 @@
+#include "stick.h"
+#include "event.h"
+#include "stats.h"
+
+#include <QRegExp>
+#include <QStringList>
+
+#include <algorithm>
+
+static Stat stickMoves("Stick mouse motions");
+
+Stick::Stick( int xa, int ya, QObject *parent )
+    : QObject(parent), xAxis(xa), yAxis(ya), x(0), y(0),
+      dZone(DZONE), xZone(XZONE), maxSpeed(100), transferCurve(Axis::Quadratic),
+      sensitivity(1.0F), invertX(false), invertY(false),
+      radialDZone(false), radialCurve(false), sumX(0), sumY(0) {
+    connect(&timer, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+Stick::~Stick() {
+    release();
+}
+
+bool Stick::read( QTextStream &stream ) {
+    QString input = stream.readLine().toLower();
+    QRegExp regex("[\\s,]+");
+    QStringList words = input.split(regex);
+
+    bool ok;
+    int val;
+    float fval;
+    for ( QStringList::Iterator it = words.begin(); it != words.end(); ++it ) {
+        if (*it == "maxspeed") {
+            ++it;
+            if (it == words.end()) return false;
+            val = (*it).toInt(&ok);
+            if (ok && val >= 0 && val <= MAXMOUSESPEED) maxSpeed = val;
+            else return false;
+        }
+        else if (*it == "dzone") {
+            ++it;
+            if (it == words.end()) return false;
+            val = (*it).toInt(&ok);
+            if (ok && val >= 0 && val <= JOYMAX) dZone = val;
+            else return false;
+        }
+        else if (*it == "xzone") {
+            ++it;
+            if (it == words.end()) return false;
+            val = (*it).toInt(&ok);
+            if (ok && val >= 0 && val <= JOYMAX) xZone = val;
+            else return false;
+        }
+        else if (*it == "tcurve") {
+            ++it;
+            if (it == words.end()) return false;
+            val = (*it).toInt(&ok);
+            if (ok && val >= 0 && val <= Axis::PowerFunction) transferCurve = val;
+            else return false;
+        }
+        else if (*it == "sens") {
+            ++it;
+            if (it == words.end()) return false;
+            fval = (*it).toFloat(&ok);
+            if (ok && fval >= SENSITIVITY_MIN && fval <= SENSITIVITY_MAX) sensitivity = fval;
+            else return false;
+        }
+        else if (*it == "invertx") {
+            invertX = true;
+        }
+        else if (*it == "inverty") {
+            invertY = true;
+        }
+        else if (*it == "radialdzone") {
+            radialDZone = true;
+        }
+        else if (*it == "radialcurve") {
+            radialCurve = true;
+        }
+    }
+    //there has to be room between the two zones
+    return xZone > dZone;
+}
+
+void Stick::write( QTextStream &stream ) {
+    stream << "\tStick " << (xAxis+1) << "+" << (yAxis+1) << ": ";
+    if (dZone != DZONE) stream << "dZone " << dZone << ", ";
+    if (xZone != XZONE) stream << "xZone " << xZone << ", ";
+    if (transferCurve != Axis::Quadratic) stream << "tCurve " << transferCurve << ", ";
+    if (sensitivity != 1.0F) stream << "sens " << sensitivity << ", ";
+    if (invertX) stream << "invertX, ";
+    if (invertY) stream << "invertY, ";
+    if (radialDZone) stream << "radialDZone, ";
+    if (radialCurve) stream << "radialCurve, ";
+    stream << "maxSpeed " << maxSpeed << "\n";
+}
+
+void Stick::release() {
+    timer.stop();
+    sumX = sumY = 0;
+}
+
+void Stick::sync( int axis, int value ) {
+    //like an axis that is already pushed: nothing happens until the next
+    //event
+    if (axis == xAxis) x = value;
+    else if (axis == yAxis) y = value;
+}
+
+void Stick::jsevent( int axis, int value ) {
+    if (axis == xAxis) x = value;
+    else if (axis == yAxis) y = value;
+    else return;
+
+    if (outside()) {
+        if (!timer.isActive()) timer.start(MSEC);
+    }
+    else if (timer.isActive()) {
+        release();
+    }
+}
+
+bool Stick::outside() const {
+    if (radialDZone) return (double) x * x + (double) y * y > (double) dZone * dZone;
+    return abs(x) > dZone || abs(y) > dZone;
+}
+
+void Stick::position( float &u, float &v ) const {
+    const float range = xZone - dZone;
+    if (radialDZone) {
+        //the dead zone is a circle, and the rest of the way to the extreme
+        //zone is scaled to 0..1 in every direction
+        const float length = hypotf(x, y);
+        if (length <= dZone) {
+            u = v = 0;
+            return;
+        }
+        const float scale = std::min((length - dZone) / range, 1.0F) / length;
+        u = x * scale;
+        v = y * scale;
+    }
+    else {
+        u = abs(x) <= dZone ? 0 : std::min((abs(x) - dZone) / range, 1.0F);
+        v = abs(y) <= dZone ? 0 : std::min((abs(y) - dZone) / range, 1.0F);
+        if (x < 0) u = -u;
+        if (y < 0) v = -v;
+    }
+}
+
+void Stick::tick() {
+    float u, v;
+    position(u, v);
+    float dx, dy;
+    if (radialCurve) {
+        //the curve decides the speed, the stick only the direction
+        const float length = hypotf(u, v);
+        const float speed = length > 0 ? Axis::transfer(transferCurve, std::min(length, 1.0F), sensitivity) / length : 0;
+        dx = u * speed;
+        dy = v * speed;
+    }
+    else {
+        dx = Axis::transfer(transferCurve, fabsf(u), sensitivity);
+        dy = Axis::transfer(transferCurve, fabsf(v), sensitivity);
+        if (u < 0) dx = -dx;
+        if (v < 0) dy = -dy;
+    }
+    if (invertX) dx = -dx;
+    if (invertY) dy = -dy;
+
+    sumX += dx * maxSpeed;
+    sumY += dy * maxSpeed;
+    FakeEvent e;
+    e.type = FakeEvent::MouseMove;
+    e.move.x = static_cast<int>(rint(sumX));
+    e.move.y = static_cast<int>(rint(sumY));
+    sumX -= e.move.x;
+    sumY -= e.move.y;
+    if (e.move.x == 0 && e.move.y == 0) return;
+    stickMoves.count();
+    sendevent(e);
+}
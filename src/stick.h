@@ -0,0 +1,62 @@
+#ifndef QJOYPAD_STICK_H
+#define QJOYPAD_STICK_H
+
+#include <QTimer>
+#include <QTextStream>
+
+//for the transfer curves and default zones
+#include "axis.h"
+
+//two axes (usually the two of a thumb stick) that move the mouse together.
+//Each tick makes a single motion in both directions instead of one per axis,
+//so diagonals are smooth. The dead zone and transfer curve can be applied to
+//how far the stick is pushed in any direction (radial) instead of to each
+//axis on its own.
+class Stick : public QObject {
+	Q_OBJECT
+	public:
+		//xAxis moves the mouse across, yAxis up and down
+		Stick( int xAxis, int yAxis, QObject *parent = 0 );
+		~Stick();
+		//read the settings that follow "Stick 1+2:"
+		bool read( QTextStream &stream );
+		void write( QTextStream &stream );
+		void release();
+		//an event of either of the two axes
+		void jsevent( int axis, int value );
+		//take on the initial state without moving
+		void sync( int axis, int value );
+		int xAxisIndex() const { return xAxis; }
+		int yAxisIndex() const { return yAxis; }
+	protected slots:
+		void tick();
+	protected:
+		//how far the axes are pushed, 0..1 each, after the dead zone
+		void position( float &u, float &v ) const;
+		//true iff the stick is out of its dead zone
+		bool outside() const;
+		int xAxis;
+		int yAxis;
+		//the positions, as from jsevent
+		int x;
+		int y;
+		//settings, like those of an Axis
+		int dZone;
+		int xZone;
+		int maxSpeed;
+		unsigned int transferCurve;
+		float sensitivity;
+		bool invertX;
+		bool invertY;
+		//apply the dead zone / transfer curve to the distance from the
+		//center instead of to each axis
+		bool radialDZone;
+		bool radialCurve;
+		//what's left of the motion after rounding, so slow movements
+		//still add up
+		double sumX;
+		double sumY;
+		QTimer timer;
+};
+
+#endif